@@ -0,0 +1,213 @@
+#!/bin/sh
+#
+# Run the gwsh benchmark suite.
+#
+#	bench.sh [-b baseline] [-o output] [-t percent] gwsh benchrun
+#
+# Each benchmark is run by benchrun, which prints one JSON object per
+# benchmark; the objects are collected into a JSON array on standard
+# output and, with -o, in a file.  With -b, the median wall-clock times
+# are compared with those in an earlier output file, and the script
+# fails if any benchmark has become slower by more than the threshold,
+# 10 percent unless given by -t.  BENCH_BASELINE and BENCH_THRESHOLD
+# supply the defaults for -b and -t.
+
+set -e
+
+baseline=${BENCH_BASELINE-}
+threshold=${BENCH_THRESHOLD-10}
+output=
+
+while getopts b:o:t: opt; do
+	case $opt in
+	b)	baseline=$OPTARG ;;
+	o)	output=$OPTARG ;;
+	t)	threshold=$OPTARG ;;
+	*)	exit 2 ;;
+	esac
+done
+shift $((OPTIND - 1))
+if [ $# -ne 2 ]; then
+	echo "usage: $0 [-b baseline] [-o output] [-t percent] gwsh benchrun" >&2
+	exit 2
+fi
+sh=$1
+run=$2
+# The benchmarks run in a scratch directory.
+case $sh in
+*/*)	sh=$(cd "$(dirname "$sh")" && pwd)/${sh##*/} ;;
+esac
+case $run in
+*/*)	run=$(cd "$(dirname "$run")" && pwd)/${run##*/} ;;
+esac
+case $baseline in
+''|/*)	;;
+*)	baseline=$PWD/$baseline ;;
+esac
+
+dir=$(mktemp -d "${TMPDIR:-/tmp}/gwshbench.XXXXXX")
+trap 'rm -rf "$dir"' EXIT
+trap 'exit 130' INT TERM
+
+# A tree of 20 directories of 50 files each, half of them .c files.
+i=0
+while [ $i -lt 20 ]; do
+	mkdir "$dir/tree$i"
+	j=0
+	while [ $j -lt 25 ]; do
+		: > "$dir/tree$i/f$j.c"
+		: > "$dir/tree$i/f$j.o"
+		j=$((j + 1))
+	done
+	i=$((i + 1))
+done
+
+# 20000 lines to read.
+awk 'BEGIN { for (i = 0; i < 20000; i++) print i, "some text", i * 7 }' \
+	> "$dir/lines"
+
+results=$dir/results
+: > "$results"
+
+bench() {
+	name=$1 reps=$2
+	shift 2
+	echo "bench: $name" >&2
+	(cd "$dir" && "$run" -n "$reps" "$name" "$@") >> "$results"
+}
+
+bench startup 200 "$sh" -c true
+
+bench forkexec 5 "$sh" -c '
+	i=0
+	while [ $i -lt 500 ]; do
+		/bin/true
+		i=$((i + 1))
+	done'
+
+bench subshell 5 "$sh" -c '
+	i=0
+	while [ $i -lt 2000 ]; do
+		(cd / && :)
+		i=$((i + 1))
+	done'
+
+bench variables 5 "$sh" -c '
+	i=0
+	while [ $i -lt 20000 ]; do
+		a=$i b=${a}x c=${b%x} d=${#c}
+		i=$((i + 1))
+	done'
+
+bench functions 5 "$sh" -c '
+	f() { local x=$1 y; y=$x; return 0; }
+	i=0
+	while [ $i -lt 20000 ]; do
+		f $i
+		i=$((i + 1))
+	done'
+
+bench arithmetic 5 "$sh" -c '
+	i=0 s=0
+	while [ $i -lt 50000 ]; do
+		s=$(( (s + i * 7) % 1000003 ))
+		i=$((i + 1))
+	done'
+
+bench glob 5 "$sh" -c '
+	i=0
+	while [ $i -lt 100 ]; do
+		set -- tree*/*.c
+		i=$((i + 1))
+	done'
+
+bench heredoc 5 "$sh" -c '
+	i=0
+	while [ $i -lt 5000 ]; do
+		read a b <<-EOF
+		$i here document
+		EOF
+		i=$((i + 1))
+	done'
+
+bench read 5 "$sh" -c '
+	n=0
+	while read -r a b c; do
+		n=$((n + 1))
+	done < lines'
+
+bench cmdsubst 5 "$sh" -c '
+	i=0
+	while [ $i -lt 1000 ]; do
+		x=$(echo $i)
+		i=$((i + 1))
+	done'
+
+bench case 5 "$sh" -c '
+	i=0
+	for w in alpha beta gamma delta epsilon zeta eta theta iota kappa; do
+		set -- "$@" $w
+	done
+	while [ $i -lt 2000 ]; do
+		for w; do
+			case $w in
+			a*a) ;;
+			b*|c*) ;;
+			[de]*) ;;
+			*eta) ;;
+			*) ;;
+			esac
+		done
+		i=$((i + 1))
+	done'
+
+bench test 5 "$sh" -c '
+	i=0
+	while [ $i -lt 20000 ]; do
+		[ -d tree0 ] && [ -f lines ] && [ "$i" != x ]
+		i=$((i + 1))
+	done'
+
+bench printf 5 "$sh" -c '
+	i=0
+	while [ $i -lt 20000 ]; do
+		printf "%d %s %5.2f\n" $i word 1.5
+		i=$((i + 1))
+	done > /dev/null'
+
+awk 'BEGIN { print "[" }
+	{ printf "%s%s", sep, $0; sep = ",\n" }
+	END { print "\n]" }' "$results" > "$dir/json"
+cat "$dir/json"
+if [ -n "$output" ]; then
+	cp "$dir/json" "$output"
+fi
+
+[ -n "$baseline" ] || exit 0
+awk -v threshold="$threshold" '
+	function field(line, key,    s) {
+		if (!match(line, "\"" key "\": *[^,}]*"))
+			return ""
+		s = substr(line, RSTART, RLENGTH)
+		sub(/^[^:]*: */, "", s)
+		gsub(/"/, "", s)
+		return s
+	}
+	FNR == NR {
+		if ((name = field($0, "name")) != "")
+			base[name] = field($0, "wall_med_us")
+		next
+	}
+	(name = field($0, "name")) != "" {
+		cur = field($0, "wall_med_us")
+		if (!(name in base) || base[name] <= 0) {
+			printf "%-12s %10d us      (new)\n", name, cur
+			next
+		}
+		change = (cur - base[name]) * 100 / base[name]
+		flag = change > threshold ? "  REGRESSION" : ""
+		printf "%-12s %10d us %+6.1f%%%s\n", name, cur, change, flag
+		if (flag != "")
+			failed = 1
+	}
+	END { exit failed }' "$baseline" "$dir/json" >&2
@@ -0,0 +1,259 @@
+/*-
+ * Copyright (c) 2026
+ *	The gwsh authors.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Run a command a number of times and write what it cost as one line of
+ * JSON: the fastest and the median wall-clock time, and the mean user
+ * and system time, all in microseconds.  Where perf_event_open is
+ * available and allowed, the mean numbers of cycles and instructions of
+ * the command and all its children are added.
+ *
+ *	benchrun [-n reps] [-w warmups] name command [arg ...]
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#define NCOUNTERS 2
+
+static const char *const counternames[NCOUNTERS] = {
+	"cycles", "instructions"
+};
+
+struct sample {
+	int64_t wall;
+	int64_t user;
+	int64_t sys;
+	int64_t count[NCOUNTERS];
+	int counted;
+};
+
+static int64_t
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t
+tvusec(const struct timeval *tv)
+{
+	return (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/*
+ * Attach the counters to a child that has not executed its command yet.
+ * They start counting at exec and include the child's own children.
+ */
+static int
+opencounters(pid_t pid, int *fds)
+{
+#ifdef __linux__
+	static const uint64_t configs[NCOUNTERS] = {
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS
+	};
+	struct perf_event_attr attr;
+	int i;
+
+	for (i = 0; i < NCOUNTERS; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = configs[i];
+		attr.disabled = 1;
+		attr.enable_on_exec = 1;
+		attr.inherit = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fds[i] = syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+		if (fds[i] < 0) {
+			while (--i >= 0)
+				close(fds[i]);
+			return 0;
+		}
+	}
+	return 1;
+#else
+	(void)pid;
+	(void)fds;
+	return 0;
+#endif
+}
+
+static void
+runonce(char **argv, struct sample *sp)
+{
+	struct rusage ru;
+	int64_t start;
+	int fds[NCOUNTERS];
+	int sync[2];
+	int status;
+	pid_t pid;
+	char c;
+	int i;
+
+	if (pipe(sync) < 0) {
+		perror("pipe");
+		exit(2);
+	}
+	start = now();
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(2);
+	}
+	if (pid == 0) {
+		close(sync[1]);
+		if (read(sync[0], &c, 1) < 0)
+			_exit(127);
+		close(sync[0]);
+		execvp(argv[0], argv);
+		fprintf(stderr, "benchrun: %s: %s\n", argv[0], strerror(errno));
+		_exit(127);
+	}
+	close(sync[0]);
+	sp->counted = opencounters(pid, fds);
+	close(sync[1]);
+
+	while (wait4(pid, &status, 0, &ru) < 0)
+		if (errno != EINTR) {
+			perror("wait4");
+			exit(2);
+		}
+	sp->wall = now() - start;
+	sp->user = tvusec(&ru.ru_utime);
+	sp->sys = tvusec(&ru.ru_stime);
+	for (i = 0; sp->counted && i < NCOUNTERS; i++) {
+		uint64_t v;
+
+		if (read(fds[i], &v, sizeof(v)) != sizeof(v))
+			sp->counted = 0;
+		sp->count[i] = v;
+		close(fds[i]);
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		fprintf(stderr, "benchrun: %s failed with status %d\n",
+			argv[0], status);
+		exit(1);
+	}
+}
+
+static int
+cmpwall(const void *a, const void *b)
+{
+	const struct sample *sa = a, *sb = b;
+
+	return (sa->wall > sb->wall) - (sa->wall < sb->wall);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct sample *samples;
+	int64_t user, sys, count[NCOUNTERS];
+	int reps = 10;
+	int warmups = 1;
+	int counted;
+	const char *name;
+	int c, i, j;
+
+	while ((c = getopt(argc, argv, "+n:w:")) != -1) {
+		switch (c) {
+		case 'n':
+			reps = atoi(optarg);
+			break;
+		case 'w':
+			warmups = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	argv += optind;
+	if (reps < 1 || warmups < 0 || !argv[0] || !argv[1]) {
+usage:
+		fprintf(stderr,
+			"usage: benchrun [-n reps] [-w warmups] name command "
+			"[arg ...]\n");
+		return 2;
+	}
+	name = *argv++;
+
+	samples = calloc(reps, sizeof(*samples));
+	if (!samples) {
+		perror("benchrun");
+		return 2;
+	}
+	for (i = 0; i < warmups; i++)
+		runonce(argv, &samples[0]);
+	for (i = 0; i < reps; i++)
+		runonce(argv, &samples[i]);
+
+	user = sys = 0;
+	counted = 1;
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < reps; i++) {
+		user += samples[i].user;
+		sys += samples[i].sys;
+		counted &= samples[i].counted;
+		for (j = 0; j < NCOUNTERS; j++)
+			count[j] += samples[i].count[j];
+	}
+	qsort(samples, reps, sizeof(*samples), cmpwall);
+
+	printf("{\"name\": \"%s\", \"reps\": %d, \"wall_min_us\": %lld, "
+	       "\"wall_med_us\": %lld, \"user_us\": %lld, \"sys_us\": %lld",
+	       name, reps, (long long)samples[0].wall,
+	       (long long)samples[reps / 2].wall, (long long)(user / reps),
+	       (long long)(sys / reps));
+	for (j = 0; j < NCOUNTERS; j++) {
+		if (counted)
+			printf(", \"%s\": %lld", counternames[j],
+			       (long long)(count[j] / reps));
+		else
+			printf(", \"%s\": null", counternames[j]);
+	}
+	printf("}\n");
+	return 0;
+}
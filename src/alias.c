@@ -127,6 +127,22 @@ lookupalias(const char *name, int check)
 	return (ap);
 }
 
+/*
+ * Add up the aliases and the memory they take for meminfo.
+ */
+void
+aliasmemuse(struct memuse *mu)
+{
+	struct alias *ap;
+	int i;
+
+	for (i = 0; i < ATABSIZE; i++)
+		for (ap = atab[i]; ap; ap = ap->next) {
+			mu->count++;
+			mu->bytes += sizeof(*ap) + strlen(ap->name) + 1;
+		}
+}
+
 /*
  * TODO - sort output
  */
@@ -52,6 +52,8 @@ struct alias {
 
 extern struct alias *aliasdone;
 
+struct memuse;
+
 struct alias *lookupalias(const char *, int);
 int aliascmd(int, char **);
 int unaliascmd(int, char **);
@@ -59,5 +61,6 @@ void rmaliases(void);
 int unalias(const char *);
 void printalias(const struct alias *);
 void endaliasuse(void);
+void aliasmemuse(struct memuse *);
 
 #endif
@@ -55,6 +55,25 @@ static const char *getstr(void);
 static char	  *mklong(const char *, const char *);
 static void        check_conversion(const char *, const char *);
 
+/*
+ * A format is broken up once per printf command into literal text, with
+ * escapes already converted, and conversion specifications.  These are
+ * then used for each group of arguments.
+ */
+struct fmtseg {
+	const char *text;	/* literal text or specification, or NULL */
+	size_t len;		/* length of literal text */
+	int conv;		/* conversion character, 0 for literal text or
+				   -1 if it is missing */
+	char wstar;		/* field width is '*' */
+	char pstar;		/* precision is '*' */
+	char plain;		/* specification is '%' and conv only */
+};
+
+static struct fmtseg *compileformat(const char *);
+static int printseg(const struct fmtseg *);
+static void printint(uintmax_t, int);
+
 static int	rval;
 static char  **gargv;
 
@@ -129,9 +148,10 @@ easy:
 int
 printfcmd(int argc, char *argv[])
 {
-	char *fmt;
+	struct stackmark smark;
+	struct fmtseg *segs;
+	const struct fmtseg *sp;
 	char *format;
-	int ch;
 
 	rval = 0;
 
@@ -145,133 +165,231 @@ printfcmd(int argc, char *argv[])
 
 	gargv = ++argv;
 
-#define SKIP1	"#-+ 0"
-#define SKIP2	"*0123456789"
+	setstackmark(&smark);
+	segs = compileformat(format);
 	do {
 		/*
-		 * Basic algorithm is to scan the format string for conversion
-		 * specifications -- once one is found, find out if the field
-		 * width or precision is a '*'; if it is, gather up value. 
 		 * Note, format strings are reused as necessary to use up the
 		 * provided arguments, arguments of zero/null string are 
 		 * provided to use up the format string.
 		 */
+		for (sp = segs; sp->text; sp++) {
+			if (!sp->conv)
+				out1mem(sp->text, sp->len);
+			else if (!printseg(sp))
+				goto out;
+		}
+	} while (gargv != argv && *gargv);
 
-		/* find next format specification */
-		for (fmt = format; (ch = *fmt++) ;) {
-			const char *start;
-			char nextch;
-			int width = 0, prec = 0, skip = 2;
-
-			if (ch == '\\') {
-				int c_ch;
-				fmt += conv_escape(fmt, &c_ch) - fmt;
-				ch = c_ch;
-				goto pc;
-			}
-			switch (ch) {
-			case '%':
-				if (*fmt != '%')
-					break;
-				fmt++;
-				/* fall through */
-			default:
+out:
+	popstackmark(&smark);
+	return rval;
+}
+
+
+/*
+ * Break up a format into segments on the stack.  Errors in a conversion
+ * specification are only reported when it is reached, after what comes
+ * before it has been printed.
+ */
+static struct fmtseg *
+compileformat(const char *format)
+{
+	struct fmtseg *segs, *sp;
+	const char *fmt;
+	char *lit;
+	size_t n;
+	int ch;
+
+	n = 2;
+	for (fmt = format; (fmt = strchr(fmt, '%')); fmt++)
+		n += 2;
+	segs = sp = stalloc(n * sizeof(*segs));
+	lit = stalloc(strlen(format) + 1);
+
+	sp->text = lit;
+	sp->len = 0;
+	sp->conv = 0;
+
+#define SKIP1	"#-+ 0"
+#define SKIP2	"*0123456789"
+	for (fmt = format; (ch = *fmt++) ;) {
+		const char *start;
+		char *spec;
+		size_t len;
+
+		if (ch == '\\') {
+			fmt = conv_escape(fmt, &ch);
+			goto pc;
+		}
+		if (ch != '%')
+			goto pc;
+		if (*fmt == '%') {
+			fmt++;
 pc:
-				putchar(ch);
-				continue;
-			}
+			*lit++ = ch;
+			sp->len++;
+			continue;
+		}
 
-			/* Ok - we've found a format specification,
-			   Save its address for a later printf(). */
-			start = fmt - 1;
+		/* Ok - we've found a format specification. */
+		if (sp->len)
+			sp++;
+		start = fmt - 1;
+		sp->conv = -1;
+		sp->wstar = sp->pstar = 0;
+
+		/* skip to field width */
+		fmt += strspn(fmt, SKIP1);
+		if (*fmt == '*') {
+			++fmt;
+			sp->wstar = 1;
+		} else {
+			/* skip to possible '.',
+			 * get following precision
+			 */
+			fmt += strspn(fmt, SKIP2);
+		}
 
-			/* skip to field width */
-			fmt += strspn(fmt, SKIP1);
+		if (*fmt == '.') {
+			++fmt;
 			if (*fmt == '*') {
 				++fmt;
-				width = prec = getuintmax(1);
-				skip--;
-			} else {
-				/* skip to possible '.',
-				 * get following precision
-				 */
+				sp->pstar = 1;
+			} else
 				fmt += strspn(fmt, SKIP2);
-			}
+		}
 
-			if (*fmt == '.') {
-				++fmt;
-				if (*fmt == '*') {
-					++fmt;
-					prec = getuintmax(1);
-					skip--;
-				} else
-					fmt += strspn(fmt, SKIP2);
-			}
-
-			ch = *fmt;
-			if (!ch)
-				error("missing format character");
-			/* null terminate format string to we can use it
-			   as an argument to printf. */
-			nextch = fmt[1];
-			fmt[1] = 0;
-			switch (ch) {
-
-			case 'b':
-				/* escape if a \c was encountered */
-				*fmt = 's';
-				if (!print_escape_str(skip, start, width, prec,
-						      getstr()))
-					goto out;
-				*fmt = 'b';
-				break;
-			case 'c': {
-				int p = getchr();
-				printfield(NULL, skip, start, width, prec, p);
-				break;
-			}
-			case 's': {
-				const char *p = getstr();
-				printfield(NULL, skip, start, width, prec, p);
-				break;
-			}
-			case 'd':
-			case 'i': {
-				uintmax_t p = getuintmax(1);
-				start = mklong(start, fmt);
-				printfield(NULL, skip, start, width, prec, p);
-				break;
-			}
-			case 'o':
-			case 'u':
-			case 'x':
-			case 'X': {
-				uintmax_t p = getuintmax(0);
-				start = mklong(start, fmt);
-				printfield(NULL, skip, start, width, prec, p);
-				break;
-			}
-			case 'a':
-			case 'A':
-			case 'e':
-			case 'E':
-			case 'f':
-			case 'F':
-			case 'g':
-			case 'G': {
-				double p = getdouble();
-				printfield(NULL, skip, start, width, prec, p);
-				break;
-			}
-			default:
-				error("%s: invalid directive", start);
-			}
-			*++fmt = nextch;
+		sp->text = start;
+		if (!*fmt) {
+			sp++;
+			break;
 		}
-	} while (gargv != argv && *gargv);
+		sp->conv = *fmt++;
+		len = fmt - start;
+		sp->plain = len == 2;
+		if (strchr("diouxX", sp->conv)) {
+			spec = mklong(start, fmt - 1);
+			grabstackstr(spec + strlen(spec) + 1);
+		} else {
+			spec = stalloc(len + 1);
+			memcpy(spec, start, len);
+			spec[len] = 0;
+			/* %b is printed with %s after conversion. */
+			if (sp->conv == 'b')
+				spec[len - 1] = 's';
+		}
+		sp->text = spec;
 
-out:
-	return rval;
+		sp++;
+		sp->text = lit;
+		sp->len = 0;
+		sp->conv = 0;
+	}
+	if (!sp->conv && sp->len)
+		sp++;
+	sp->text = NULL;
+
+	return segs;
+}
+
+
+/*
+ * Print one conversion, taking its arguments from gargv.  Returns 0 if a
+ * \c in a %b argument ends all output.
+ */
+static int
+printseg(const struct fmtseg *sp)
+{
+	const char *start = sp->text;
+	int width = 0, prec = 0, skip = 2;
+
+	if (sp->wstar) {
+		width = prec = getuintmax(1);
+		skip--;
+	}
+	if (sp->pstar) {
+		prec = getuintmax(1);
+		skip--;
+	}
+
+	switch (sp->conv) {
+	case -1:
+		error("missing format character");
+	case 'b':
+		return print_escape_str(skip, start, width, prec, getstr());
+	case 'c': {
+		int p = getchr();
+		if (sp->plain)
+			out1c(p);
+		else
+			printfield(NULL, skip, start, width, prec, p);
+		break;
+	}
+	case 's': {
+		const char *p = getstr();
+		if (sp->plain)
+			out1str(p);
+		else
+			printfield(NULL, skip, start, width, prec, p);
+		break;
+	}
+	case 'd':
+	case 'i':
+	case 'o':
+	case 'u':
+	case 'x':
+	case 'X': {
+		uintmax_t p = getuintmax(sp->conv == 'd' || sp->conv == 'i');
+		if (sp->plain)
+			printint(p, sp->conv);
+		else
+			printfield(NULL, skip, start, width, prec, p);
+		break;
+	}
+	case 'a':
+	case 'A':
+	case 'e':
+	case 'E':
+	case 'f':
+	case 'F':
+	case 'g':
+	case 'G': {
+		double p = getdouble();
+		printfield(NULL, skip, start, width, prec, p);
+		break;
+	}
+	default:
+		error("%s: invalid directive", start);
+	}
+
+	return 1;
+}
+
+
+/*
+ * Print an integer with no flags, width or precision.
+ */
+static void
+printint(uintmax_t val, int conv)
+{
+	char buf[sizeof(val) * CHAR_BIT / 3 + 3];
+	char *p = buf + sizeof(buf);
+	const char *digits = conv == 'X' ? "0123456789ABCDEF" :
+					   "0123456789abcdef";
+	unsigned base = conv == 'o' ? 8 : conv == 'x' || conv == 'X' ? 16 : 10;
+	int neg = 0;
+
+	if ((conv == 'd' || conv == 'i') && (intmax_t)val < 0) {
+		neg = 1;
+		val = -val;
+	}
+	do
+		*--p = digits[val % base];
+	while (val /= base);
+	if (neg)
+		*--p = '-';
+	out1mem(p, buf + sizeof(buf) - p);
 }
 
 
@@ -387,7 +387,7 @@ filstat(char *nm, enum token mode)
 {
 	struct stat s;
 
-	if (mode == FILSYM ? lstat(nm, &s) : stat(nm, &s))
+	if (cachedstat(nm, &s, mode == FILSYM))
 		return 0;
 
 	switch (mode) {
@@ -475,14 +475,14 @@ newerf (const char *f1, const char *f2)
 	struct stat b1, b2;
 
 #ifdef HAVE_ST_MTIM
-	return (stat (f1, &b1) == 0 &&
-		(stat (f2, &b2) != 0 ||
+	return (cachedstat(f1, &b1, 0) == 0 &&
+		(cachedstat(f2, &b2, 0) != 0 ||
 		 b1.st_mtim.tv_sec > b2.st_mtim.tv_sec ||
 		 (b1.st_mtim.tv_sec == b2.st_mtim.tv_sec &&
 		  b1.st_mtim.tv_nsec > b2.st_mtim.tv_nsec)));
 #else
-	return (stat (f1, &b1) == 0 &&
-		(stat (f2, &b2) != 0 ||
+	return (cachedstat(f1, &b1, 0) == 0 &&
+		(cachedstat(f2, &b2, 0) != 0 ||
 		 b1.st_mtime > b2.st_mtime));
 #endif
 }
@@ -493,14 +493,14 @@ olderf (const char *f1, const char *f2)
 	struct stat b1, b2;
 
 #ifdef HAVE_ST_MTIM
-	return (stat (f2, &b2) == 0 &&
-		(stat (f1, &b1) != 0 ||
+	return (cachedstat(f2, &b2, 0) == 0 &&
+		(cachedstat(f1, &b1, 0) != 0 ||
 		 b1.st_mtim.tv_sec < b2.st_mtim.tv_sec ||
 		 (b1.st_mtim.tv_sec == b2.st_mtim.tv_sec &&
 		  b1.st_mtim.tv_nsec < b2.st_mtim.tv_nsec)));
 #else
-	return (stat (f2, &b2) == 0 &&
-		(stat (f1, &b1) != 0 ||
+	return (cachedstat(f2, &b2, 0) == 0 &&
+		(cachedstat(f1, &b1, 0) != 0 ||
 		 b1.st_mtime < b2.st_mtime));
 #endif
 }
@@ -510,8 +510,8 @@ equalf (const char *f1, const char *f2)
 {
 	struct stat b1, b2;
 
-	return (stat (f1, &b1) == 0 &&
-		stat (f2, &b2) == 0 &&
+	return (cachedstat(f1, &b1, 0) == 0 &&
+		cachedstat(f2, &b2, 0) == 0 &&
 		b1.st_dev == b2.st_dev &&
 		b1.st_ino == b2.st_ino);
 }
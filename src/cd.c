@@ -38,6 +38,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -77,6 +78,14 @@ static int cdopt(void);
 static char *physdir = NULL; /* physical working directory */
 #endif
 
+/*
+ * Identity of the current directory.  Only docd changes it, so once known
+ * it saves a stat of "." each time a logical pwd is checked against $PWD.
+ */
+static dev_t curdev;
+static ino_t curino;
+static int curknown;
+
 static int
 cdopt(void)
 {
@@ -196,6 +205,7 @@ docd(const char *dest, int flags)
 	err = chdir(dest);
 	if (err)
 		goto out;
+	curknown = 0;
 	if (!dir)
 		dir = getpwd(CD_PHYSICAL);
 	setpwd(dir, 1);
@@ -298,11 +308,16 @@ getpwd(int flags)
 	const char *dir;
 
 	if (!(flags & CD_PHYSICAL)) {
-		struct stat st1, st2;
+		struct stat st;
 
+		if (!curknown && stat(".", &st) == 0) {
+			curdev = st.st_dev;
+			curino = st.st_ino;
+			curknown = 1;
+		}
 		dir = pwdval();
-		if (stat(dir, &st1) == 0 && stat(".", &st2) == 0
-		    && st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino)
+		if (curknown && stat(dir, &st) == 0 &&
+		    st.st_dev == curdev && st.st_ino == curino)
 			return dir;
 	}
 
@@ -345,6 +360,35 @@ setpwd(const char *val, int setold)
 	setvar("PWD", val, VEXPORT);
 }
 
+/*
+ * Open the current directory, so that restorecwd can return to it.
+ * Returns -1 on failure.
+ */
+int
+savecwd(void)
+{
+	int fd;
+	int newfd;
+
+	fd = open(".", O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return -1;
+	newfd = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+	close(fd);
+	return newfd;
+}
+
+void
+restorecwd(int fd)
+{
+	if (fchdir(fd) < 0)
+		sh_warnx("cannot restore the current directory: %s",
+			 errnomsg());
+	close(fd);
+	curknown = 0;
+	hashcd();
+}
+
 void
 freepwd(void)
 {
@@ -41,5 +41,7 @@ void	setpwd(const char *, int);
 
 const char *getpwd(int);
 void	freepwd(void);
+int	savecwd(void);
+void	restorecwd(int);
 
 #endif
@@ -36,10 +36,17 @@
 
 #include "config.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
 
 /*
  * Evaluate a command.
@@ -53,14 +60,17 @@
 #include "jobs.h"
 #include "eval.h"
 #include "builtins.h"
+#include "cd.h"
 #include "options.h"
 #include "exec.h"
 #include "redir.h"
 #include "input.h"
 #include "output.h"
+#include "prof.h"
 #include "trap.h"
 #include "var.h"
 #include "memalloc.h"
+#include "meminfo.h"
 #include "error.h"
 #include "init.h"
 #include "show.h"
@@ -88,6 +98,13 @@ static int evalloop(union node *, int);
 static int evalfor(union node *, int);
 static int evalcase(union node *, int);
 static int evalsubshell(union node *, int);
+static int evalvirtual(union node *, int);
+static int virtualok(union node *, int *);
+static int virtualboth(int, union node *, int *);
+static int virtualcmd(union node *, int *);
+static int virtualredir(union node *);
+static int plainword(const char *);
+static int evaltime(union node *, int);
 static void expredir(union node *);
 static int evalpipe(union node *, int);
 static int evalcommand(union node *, int);
@@ -272,6 +289,9 @@ checkexit:
 	case NPIPE:
 		evalfn = evalpipe;
 		goto checkexit;
+	case NTIME:
+		evalfn = evaltime;
+		goto checkexit;
 	case NCASE:
 		evalfn = evalcase;
 		goto calleval;
@@ -364,13 +384,16 @@ evalloop(union node *n, int flags)
 {
 	int skip;
 	int status;
+	int fdcache;
 
 	loopnest++;
+	fdcache = pushfdcache();
 	status = 0;
 	flags &= ~EV_EXIT;
 	do {
 		int i;
 
+		statgen++;
 		i = evaltree(n->nbinary.ch1,
 			     (flags & ~EV_EXIT) | EV_TESTED);
 		skip = skiploop();
@@ -385,6 +408,7 @@ evalloop(union node *n, int flags)
 		status = evaltree(n->nbinary.ch2, flags);
 		skip = skiploop();
 	} while (!(skip & ~SKIPCONT));
+	popfdcache(fdcache);
 	loopnest--;
 
 	return status;
@@ -399,6 +423,7 @@ evalfor(union node *n, int flags)
 	union node *argp;
 	struct strlist *sp;
 	int status;
+	int fdcache;
 
 	errlinno = lineno = n->nfor.linno;
 
@@ -410,13 +435,16 @@ evalfor(union node *n, int flags)
 
 	status = 0;
 	loopnest++;
+	fdcache = pushfdcache();
 	flags &= ~EV_EXIT;
 	for (sp = arglist.list ; sp ; sp = sp->next) {
 		setvar(n->nfor.var, sp->text, 0);
+		statgen++;
 		status = evaltree(n->nfor.body, flags);
 		if (skiploop() & ~SKIPCONT)
 			break;
 	}
+	popfdcache(fdcache);
 	loopnest--;
 
 	return status;
@@ -464,6 +492,75 @@ out:
 
 
 
+/*
+ * Print one line of the report of the time reserved word.
+ */
+
+static void
+prtimeval(const char *name, struct timeval *tv0, struct timeval *tv1,
+	  int posix)
+{
+	long sec = tv1->tv_sec - tv0->tv_sec;
+	long usec = tv1->tv_usec - tv0->tv_usec;
+
+	if (usec < 0) {
+		sec--;
+		usec += 1000000;
+	}
+	if (posix)
+		outfmt(out2, "%s %ld.%02ld\n", name, sec, usec / 10000);
+	else
+		outfmt(out2, "%s\t%ldm%ld.%03lds\n", name, sec / 60, sec % 60,
+		       usec / 1000);
+}
+
+/*
+ * Run a pipeline prefixed by the time reserved word and report the elapsed
+ * real time and the user and system time used by the shell and by the
+ * children it waited for in the meantime.
+ */
+
+static int
+evaltime(union node *n, int flags)
+{
+	struct timespec ts0, ts1;
+	struct rusage self0, self1, child0, child1;
+	struct timeval tv0, tv1;
+	int posix = n->ntime.posix;
+	int status;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	getrusage(RUSAGE_SELF, &self0);
+	getrusage(RUSAGE_CHILDREN, &child0);
+
+	/* The times are reported before set -e acts on the status. */
+	status = evaltree(n->ntime.com, (flags & ~EV_EXIT) | EV_TESTED);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	getrusage(RUSAGE_SELF, &self1);
+	getrusage(RUSAGE_CHILDREN, &child1);
+
+	flushall();
+	if (!posix)
+		out2c('\n');
+	tv0.tv_sec = ts0.tv_sec;
+	tv0.tv_usec = ts0.tv_nsec / 1000;
+	tv1.tv_sec = ts1.tv_sec;
+	tv1.tv_usec = ts1.tv_nsec / 1000;
+	prtimeval("real", &tv0, &tv1, posix);
+	timeradd(&self0.ru_utime, &child0.ru_utime, &tv0);
+	timeradd(&self1.ru_utime, &child1.ru_utime, &tv1);
+	prtimeval("user", &tv0, &tv1, posix);
+	timeradd(&self0.ru_stime, &child0.ru_stime, &tv0);
+	timeradd(&self1.ru_stime, &child1.ru_stime, &tv1);
+	prtimeval("sys", &tv0, &tv1, posix);
+	flushall();
+
+	return status;
+}
+
+
+
 /*
  * Kick off a subshell to evaluate a tree.
  */
@@ -478,9 +575,13 @@ evalsubshell(union node *n, int flags)
 	errlinno = lineno = n->nredir.linno;
 
 	expredir(n->nredir.redirect);
-	if (!backgnd && flags & EV_EXIT && !have_traps() && !mflag) {
-		reset(1);
-		goto nofork;
+	if (!backgnd && !have_traps() && !mflag) {
+		if (flags & EV_EXIT) {
+			reset(1);
+			goto nofork;
+		}
+		if ((status = evalvirtual(n, flags)) >= 0)
+			return status;
 	}
 	INTOFF;
 	jp = makejob(n, 1);
@@ -502,6 +603,275 @@ nofork:
 
 
 
+/*
+ * State that a subshell run in the shell process may change beyond what
+ * evalvirtual always saves.
+ */
+#define VS_OK		1	/* the subshell can run without forking */
+#define VS_CWD		2	/* the current directory */
+#define VS_UMASK	4	/* the file creation mask */
+
+#define VS_BUDGET	64	/* nodes looked at before giving up */
+
+/*
+ * Builtins whose effects are confined to what evalvirtual restores.  cd,
+ * umask and unset are handled in virtualcmd.
+ */
+static int (*const virtualbltins[])(int, char **) = {
+	breakcmd, echocmd, exitcmd, exportcmd, falsecmd, getoptscmd, localcmd,
+	printfcmd, pwdcmd, readcmd, returncmd, setcmd, shiftcmd, testcmd,
+	truecmd, typecmd,
+};
+
+
+/*
+ * Run a subshell in the shell process itself when virtualok allows it.
+ * Variables, local variables, positional parameters, options and
+ * redirections, and if need be the current directory and file creation
+ * mask, are saved beforehand and put back afterwards, and exit and errors
+ * end just the subshell.  Returns -1 if the subshell has to be forked.
+ */
+
+static int
+evalvirtual(union node *n, int flags)
+{
+	struct shparam saveparam;
+	char **args;
+	char saveopts[NOPTS];
+	struct varsave *vars;
+	struct localvar_list *localvar_stop;
+	struct redirtab *redir_stop;
+	struct parsefile *file_stop;
+	struct stackmark smark;
+	jmp_buf *volatile savehandler;
+	jmp_buf jmploc;
+	volatile int saveint;
+	int savefuncnest;
+	int saveloopnest;
+	int savefdcache;
+	int budget = VS_BUDGET;
+	int state;
+	volatile int cwd = -1;
+	volatile mode_t mask = 0;
+	int status;
+	int e;
+
+	state = virtualboth(virtualredir(n->nredir.redirect), n->nredir.n,
+			    &budget);
+	if (!state)
+		return -1;
+	if (state & VS_CWD && (cwd = savecwd()) < 0)
+		return -1;
+
+	SAVEINT(saveint);
+	INTOFF;
+	if (state & VS_UMASK)
+		umask(mask = umask(0));
+	saveparam = shellparam;
+	/* shift moves the pointers about, so give the subshell its own. */
+	args = ckmalloc((shellparam.nparam + 1) * sizeof(*args));
+	memcpy(args, shellparam.p, (shellparam.nparam + 1) * sizeof(*args));
+	shellparam.p = args;
+	shellparam.malloc = 0;
+	memcpy(saveopts, optlist, sizeof(optlist));
+	vars = savevars();
+	localvar_stop = pushlocalvars();
+	redir_stop = pushredir(n->nredir.redirect);
+	file_stop = parsefile;
+	savefuncnest = funcnest;
+	saveloopnest = loopnest;
+	loopnest = 0;
+	savefdcache = pushfdcache();
+	setstackmark(&smark);
+	savehandler = handler;
+	if ((e = setjmp(jmploc)))
+		goto done;
+	handler = &jmploc;
+	INTON;
+
+	redirect(n->nredir.redirect, REDIR_PUSH);
+	status = evaltree(n->nredir.n, flags & ~EV_EXIT);
+
+done:
+	INTOFF;
+	handler = savehandler;
+	if (e)
+		status = exitstatus;
+	evalskip = 0;
+	unwindredir(redir_stop, 0);
+	unwindfiles(file_stop);
+	unwindlocalvars(localvar_stop, 0);
+	popfdcache(savefdcache);
+	funcnest = savefuncnest;
+	loopnest = saveloopnest;
+	restorevars(vars);
+	freeparam(&shellparam);
+	ckfree(args);
+	shellparam = saveparam;
+	if (memcmp(saveopts, optlist, sizeof(optlist))) {
+		memcpy(optlist, saveopts, sizeof(optlist));
+		optschanged();
+	}
+	if (cwd >= 0)
+		restorecwd(cwd);
+	if (state & VS_UMASK)
+		umask(mask);
+	popstackmark(&smark);
+	RESTOREINT(saveint);
+
+	/* Only an interrupt reaches beyond a subshell. */
+	if (e && exception != EXERROR && exception != EXEXIT)
+		exraise(exception);
+
+	/* As from a forked subshell, only the low eight bits are seen. */
+	return status & 0xff;
+}
+
+
+/*
+ * Check whether a tree can be run by evalvirtual: it may use only the
+ * builtins in virtualbltins, called by plain names, and functions made up
+ * of them; may not define functions or start background jobs; and may
+ * not use {var} redirections, which outlast their commands.  Pipelines
+ * and nested subshells are fine as they look after themselves.  Returns
+ * 0 if the tree has to be run in a child, or else VS_OK plus the other
+ * VS_ flags for the state it may change.
+ */
+
+static int
+virtualok(union node *n, int *budget)
+{
+	union node *cp;
+	int state;
+
+	if (n == NULL)
+		return VS_OK;
+	if (--*budget < 0)
+		return 0;
+
+	switch (n->type) {
+	case NCMD:
+		return virtualcmd(n, budget);
+	case NPIPE:
+		return n->npipe.backgnd ? 0 : VS_OK;
+	case NSUBSHELL:
+		return virtualredir(n->nredir.redirect);
+	case NREDIR:
+		return virtualboth(virtualredir(n->nredir.redirect),
+				   n->nredir.n, budget);
+	case NAND:
+	case NOR:
+	case NSEMI:
+	case NWHILE:
+	case NUNTIL:
+		return virtualboth(virtualok(n->nbinary.ch1, budget),
+				   n->nbinary.ch2, budget);
+	case NIF:
+		state = virtualok(n->nif.test, budget);
+		state = virtualboth(state, n->nif.ifpart, budget);
+		return virtualboth(state, n->nif.elsepart, budget);
+	case NFOR:
+		return virtualok(n->nfor.body, budget);
+	case NCASE:
+		state = VS_OK;
+		for (cp = n->ncase.cases; cp; cp = cp->nclist.next)
+			state = virtualboth(state, cp->nclist.body, budget);
+		return state;
+	case NNOT:
+		return virtualok(n->nnot.com, budget);
+	case NTIME:
+		return virtualok(n->ntime.com, budget);
+	}
+
+	return 0;
+}
+
+
+/*
+ * Combine the result of virtualok for one tree with that for another.
+ */
+
+static int
+virtualboth(int state, union node *n, int *budget)
+{
+	int other;
+
+	if (!state)
+		return 0;
+	other = virtualok(n, budget);
+	return other ? state | other : 0;
+}
+
+
+static int
+virtualcmd(union node *n, int *budget)
+{
+	struct cmdentry entry;
+	union node *argp;
+	const char *p;
+	int (*builtin)(int, char **);
+	int i;
+
+	if (!virtualredir(n->ncmd.redirect))
+		return 0;
+	argp = n->ncmd.args;
+	if (!argp)
+		return VS_OK;
+	if (!plainword(argp->narg.text))
+		return 0;
+
+	/* Looking further would fill the table and load FPATH functions. */
+	getcmdentry(argp->narg.text, &entry);
+	if (entry.cmdtype == CMDFUNCTION)
+		return virtualok(functree(entry.u.func)->ndefun.body, budget);
+	if (entry.cmdtype != CMDBUILTIN)
+		return 0;
+
+	builtin = entry.u.cmd->builtin;
+	if (builtin == cdcmd)
+		return VS_OK | VS_CWD;
+	if (builtin == umaskcmd)
+		return VS_OK | VS_UMASK;
+	if (builtin == unsetcmd) {
+		/* unset -f would remove a function for good. */
+		while ((argp = argp->narg.next)) {
+			p = argp->narg.text;
+			if (!plainword(p) || (*p == '-' && !equal(p, "-v")))
+				return 0;
+		}
+		return VS_OK;
+	}
+	for (i = 0; i < sizeof(virtualbltins) / sizeof(*virtualbltins); i++)
+		if (builtin == virtualbltins[i])
+			return VS_OK;
+	return 0;
+}
+
+
+static int
+virtualredir(union node *redir)
+{
+	for (; redir; redir = redir->nfile.next)
+		if (redir->nfile.fdvar)
+			return 0;
+	return VS_OK;
+}
+
+
+/*
+ * Check that a word is used as it is, without expansions or quoting.
+ */
+
+static int
+plainword(const char *p)
+{
+	for (; *p; p++)
+		if ((signed char)*p >= CTL_FIRST && (signed char)*p <= CTL_LAST)
+			return 0;
+	return 1;
+}
+
+
 /*
  * Compute the names of the files in a redirection list.
  */
@@ -603,16 +973,128 @@ evalpipe(union node *n, int flags)
 
 
 
+/*
+ * Return whether a word can be expanded without side effects: it has no
+ * command substitution or arithmetic, and no ${var=word} or ${var?word},
+ * nor, with -u set, any variable at all.  Only such a word may be
+ * expanded in the shell itself rather than in a subshell.
+ */
+
+static int
+pureword(union node *n)
+{
+	const char *p;
+
+	for (p = n->narg.text; *p; p++) {
+		switch ((signed char)*p) {
+		case CTLESC:
+			p++;
+			break;
+		case CTLBACKQ:
+		case CTLARI:
+			return 0;
+		case CTLVAR:
+			switch (*++p & VSTYPE) {
+			case VSASSIGN:
+			case VSQUESTION:
+				return 0;
+			}
+			if (uflag)
+				return 0;
+			break;
+		}
+	}
+	return 1;
+}
+
+
+/*
+ * Get the output of $(<file), which is the contents of the file, without
+ * forking.  A regular file is read at once into a block obtained from
+ * malloc, leaving out trailing newlines; it is not mapped, since a file
+ * truncated meanwhile would then raise SIGBUS.  Anything else, such as a
+ * pipe, is left open for the caller to read.
+ */
+
+static void
+evalbackfile(union node *redir, struct backcmd *result)
+{
+	struct stat st;
+	char *name;
+	char *buf;
+	size_t len;
+	size_t got;
+	ssize_t i;
+	int fd;
+
+	name = expandredir(redir->nfile.fname);
+	back_exitstatus = 0;
+	if ((fd = open(name, O_RDONLY | O_CLOEXEC)) < 0) {
+		sh_warnx("cannot open %s: %s", name, errnomsg());
+		back_exitstatus = 2;
+		return;
+	}
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || !st.st_size ||
+	    (off_t)(len = st.st_size) != st.st_size) {
+		result->fd = fd;
+		return;
+	}
+
+	buf = ckmalloc(len);
+	for (got = 0; got < len; got += i) {
+		i = read(fd, buf + got, len - got);
+		if (i < 0 && errno == EINTR)
+			i = 0;
+		else if (i <= 0)
+			break;
+	}
+	close(fd);
+	while (got && buf[got - 1] == '\n')
+		got--;
+	result->buf = buf;
+	result->nleft = got;
+}
+
+
+/*
+ * Copy the file of $(<file) to standard output and exit.  This is done in
+ * the subshell when expanding the name of the file might change the shell.
+ */
+
+static void
+catbackfile(union node *redir)
+{
+	char *name;
+	char buf[8192];
+	ssize_t i;
+	int fd;
+
+	name = expandredir(redir->nfile.fname);
+	if ((fd = open(name, O_RDONLY)) < 0)
+		sh_error("cannot open %s: %s", name, errnomsg());
+	for (;;) {
+		i = read(fd, buf, sizeof(buf));
+		if (i < 0 && errno == EINTR)
+			continue;
+		if (i <= 0 || xwrite(1, buf, i) < 0)
+			break;
+	}
+	_exit(0);
+}
+
+
 /*
  * Execute a command inside back quotes.  If it's a builtin command, we
  * want to save its output in a block obtained from malloc.  Otherwise
  * we fork off a subprocess and get the output of the command via a pipe.
+ * A command that is only an input redirection, $(<file), is done here.
  * Should be called with interrupts off.
  */
 
 void
 evalbackcmd(union node *n, int flags, struct backcmd *result)
 {
+	union node *redir;
 	int pip[2];
 	struct job *jp;
 
@@ -624,6 +1106,17 @@ evalbackcmd(union node *n, int flags, struct backcmd *result)
 		goto out;
 	}
 
+	redir = NULL;
+	if (n->type == NCMD && !n->ncmd.args && !n->ncmd.assign &&
+	    (redir = n->ncmd.redirect) &&
+	    (redir->type != NFROM || redir->nfile.fd != 0 ||
+	     redir->nfile.next))
+		redir = NULL;
+	if (redir && pureword(redir->nfile.fname)) {
+		evalbackfile(redir, result);
+		goto out;
+	}
+
 	if (pipe(pip) < 0)
 		sh_error("Pipe call failed");
 	jp = makejob(n, 1);
@@ -634,16 +1127,23 @@ evalbackcmd(union node *n, int flags, struct backcmd *result)
 			dup2(pip[1], 1);
 			close(pip[1]);
 		}
+		if (flags & EV_PGRP)
+			setpgid(0, 0);
 		ifsfree();
-		evaltreenr(n, flags);
+		if (redir)
+			catbackfile(redir);
+		evaltreenr(n, flags & ~EV_PGRP);
 		/* NOTREACHED */
 	}
+	/* This can fail because we are doing it in the child also */
+	if (flags & EV_PGRP)
+		(void)setpgid(jp->ps->pid, jp->ps->pid);
 	close(pip[1]);
 	result->fd = pip[0];
 	result->jp = jp;
 
 out:
-	TRACE(("evalbackcmd done: fd=%d buf=0x%x nleft=%d jp=0x%x\n",
+	TRACE(("evalbackcmd done: fd=%d buf=0x%x nleft=%zu jp=0x%x\n",
 		result->fd, result->buf, result->nleft, result->jp));
 }
 
@@ -707,8 +1207,14 @@ evalcommand(union node *cmd, int flags)
 	int status;
 	char **nargv;
 	int cmdflags = 0;
+	struct profstamp profstart;
+	int profile = profiling;
+	int profsave = profdepth;
+	intmax_t tracestart = 0;
 
 	errlinno = lineno = cmd->ncmd.linno;
+	if (profile)
+		profstamp(&profstart);
 
 	/* First expand the arguments. */
 	TRACE(("evalcommand(0x%lx, %d) called\n", (long)cmd, flags));
@@ -838,6 +1344,11 @@ evalcommand(union node *cmd, int flags)
 		}
 	}
 
+	/* Files may change from here on; see cachedstat. */
+	if (cmdentry.cmdtype != CMDBUILTIN ||
+	    cmdentry.u.cmd->builtin != testcmd)
+		statgen++;
+
 	if (status) {
 bail:
 		exitstatus = status;
@@ -851,11 +1362,28 @@ bail:
 
 	jp = NULL;
 
+	if (profile)
+		profenter(argc ? argv[0] : ":",
+			  cmdentry.cmdtype == CMDFUNCTION, cmd->ncmd.linno,
+			  &profstart);
+
+	if (etracefd >= 0) {
+		tracestart = etracebegin("start");
+		etraceint("line", cmd->ncmd.linno);
+		etraceargv("argv", argv);
+		etraceend();
+	}
+
 	/* Execute the command. */
 	switch (cmdentry.cmdtype) {
 	default:
-		/* Fork off a child process if necessary. */
-		if (!(flags & EV_EXIT) || have_traps() || mflag) {
+		/*
+		 * Fork off a child process if necessary.  The profile and
+		 * the memory report are written on exit, so the shell must
+		 * outlive the command.
+		 */
+		if (!(flags & EV_EXIT) || have_traps() || mflag ||
+		    profiling || meminfowanted()) {
 			INTOFF;
 			jp = makejob(cmd, 1);
 			if (forkshell(jp, cmd, FORK_FG) != 0)
@@ -891,6 +1419,12 @@ raise:
 	FORCEINTON;
 
 out:
+	profleave(profsave);
+	if (tracestart && etracefd >= 0) {
+		etraceint("dur", etracebegin("end") - tracestart);
+		etraceint("status", status);
+		etraceend();
+	}
 	if (cmd->ncmd.redirect)
 		popredir(execcmd);
 	unwindredir(redir_stop, 0);
@@ -956,10 +1490,12 @@ evalfun(struct funcnode *func, int argc, char **argv, int flags)
 	int e;
 	int savefuncnest;
 	int saveloopnest;
+	int savefdcache;
 
 	saveparam = shellparam;
 	savefuncnest = funcnest;
 	saveloopnest = loopnest;
+	savefdcache = pushfdcache();
 	savehandler = handler;
 	if ((e = setjmp(jmploc))) {
 		goto funcdone;
@@ -973,9 +1509,10 @@ evalfun(struct funcnode *func, int argc, char **argv, int flags)
 	INTON;
 	shellparam.nparam = argc - 1;
 	shellparam.p = argv + 1;
-	evaltree(func->n.ndefun.body, flags);
+	evaltree(functree(func)->ndefun.body, flags);
 funcdone:
 	INTOFF;
+	popfdcache(savefdcache);
 	loopnest = saveloopnest;
 	funcnest = savefuncnest;
 	freefunc(func);
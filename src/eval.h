@@ -47,7 +47,7 @@ extern int savestatus;		/* exit status of last command outside traps */
 struct backcmd {		/* result of evalbackcmd */
 	int fd;			/* file descriptor to read from */
 	char *buf;		/* buffer */
-	int nleft;		/* number of chars in buffer */
+	size_t nleft;		/* number of chars in buffer */
 	struct job *jp;		/* job structure for command */
 };
 
@@ -56,6 +56,7 @@ struct backcmd {		/* result of evalbackcmd */
 #define EV_TESTED 2		/* exit status is checked; ignore -e flag */
 #define EV_XTRACE 4		/* expanding xtrace prompt; ignore -x flag */
 #define EV_LINENO 8		/* for evalstring(): track line numbers when parsing */
+#define EV_PGRP 16		/* evalbackcmd(): run in a process group of its own */
 
 int evalstring(const char *, int);
 union node;	/* BLETCH for ansi C */
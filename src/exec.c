@@ -38,6 +38,8 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <dirent.h>
+#include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdlib.h>
@@ -75,11 +77,17 @@
 #include "alias.h"
 #include "system.h"
 #include "cd.h"
+#include "fpindex.h"
 
 
 #define CMDTABLESIZE 31		/* should be prime */
 #define ARB 1			/* actual size determined at run time */
 
+#if !defined(HAVE_ST_MTIM) && defined(HAVE_ST_MTIMESPEC)
+#define HAVE_ST_MTIM
+#define st_mtim st_mtimespec
+#endif
+
 
 
 struct tblentry {
@@ -93,7 +101,56 @@ struct tblentry {
 
 static struct tblentry *cmdtable[CMDTABLESIZE];
 
+
+/*
+ * An index of the names in a directory searched for commands.  A table of
+ * NULL means the directory could not be read, so has to be probed with
+ * stat().
+ */
+
+struct pathdir {
+	struct pathdir *next;
+	unsigned gen;		/* value of pathgen when last validated */
+	time_t checked;		/* when the directory was last stat()ed */
+	dev_t dev;		/* identity of the directory indexed */
+	ino_t ino;
+	time_t sec;		/* modification time of the directory */
+	long nsec;
+	unsigned mask;		/* size of table - 1 */
+	unsigned *table;	/* offsets into names plus one, or 0 */
+	char *names;		/* the names, each terminated by a nul */
+	char path[ARB];		/* the directory, with a trailing slash */
+};
+
+static struct pathdir *pathdirs;
+static unsigned noentries[1];
+
+unsigned pathgen;
+
+/*
+ * Recent results of stat() and lstat(), shared by test, command lookup and
+ * globbing.  An entry is trusted only while both statgen and pathgen are
+ * unchanged, which lasts no longer than a run of consecutive test commands
+ * in one loop iteration.
+ */
+
+#define STATCACHESIZE 32
+
+struct statentry {
+	unsigned gen;		/* value of statgen when filled */
+	unsigned pgen;		/* value of pathgen when filled */
+	int lnk;		/* set for lstat() */
+	int err;		/* errno from the call, or 0 */
+	struct stat sb;
+	char name[128];		/* longer names are not cached */
+};
+
+static struct statentry statcache[STATCACHESIZE];
+
+unsigned statgen = 1;
+
 static void tryexec(char *, char **, char **);
+static int pathdirhas(char *, const char *);
 static void printentry(struct tblentry *);
 static void clearcmdentry(void);
 static struct tblentry *cmdlookup(const char *, int);
@@ -171,6 +228,13 @@ tryexec(char *cmd, char **argv, char **envp)
 #endif
 
 repeat:
+	if (etracefd >= 0) {
+		etracebegin("exec");
+		etracestr("path", cmd);
+		etraceargv("argv", argv);
+		etraceend();
+		etraceflush();
+	}
 #ifdef SYSV
 	do {
 		execve(cmd, argv, envp);
@@ -252,6 +316,7 @@ hashcmd(int argc, char **argv)
 
 	while (nextopt("r") != '\0') {
 		clearcmdentry();
+		pathgen++;
 		return 0;
 	}
 	if (*argptr == NULL) {
@@ -320,7 +385,7 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path, cons
 	if (strchr(name, '/') != NULL) {
 		entry->u.index = -1;
 		if (act & DO_ABS) {
-			while (stat(name, &statb) < 0) {
+			while (cachedstat(name, &statb, 0) < 0) {
 				e = errno;
 #ifdef SYSV
 				if (e == EINTR)
@@ -402,7 +467,16 @@ loop:
 				TRACE(("searchexec \"%s\": no change\n", name));
 				goto success;
 			}
-			while (stat(fullname, &statb) < 0) {
+			if (!checkexec) {
+				/* an FPATH directory, which may be indexed */
+				stalloc(len);
+				if (fpindexload(fullname, name))
+					goto fpath_success;
+				stunalloc(fullname);
+			}
+			if (fullname[0] == '/' && !pathdirhas(fullname, name))
+				continue;
+			while (cachedstat(fullname, &statb, 0) < 0) {
 #ifdef SYSV
 				if (errno == EINTR)
 					continue;
@@ -417,12 +491,7 @@ loop:
 			if (!checkexec) { /* this is an FPATH directory */
 				stalloc(len);
 				readcmdfile(fullname);
-				if ((cmdp = cmdlookup(name, 0)) == NULL ||
-				    cmdp->cmdtype != CMDFUNCTION)
-					sh_error("%s not defined in %s", name,
-						 fullname);
-				stunalloc(fullname);
-				goto success;
+				goto fpath_success;
 			}
 #ifdef HAVE_FACCESSAT
 			if (!test_file_access(fullname, X_OK))
@@ -458,6 +527,13 @@ loop:
 	entry->u.index = idx;
 	return e;
 
+fpath_success:
+	if ((cmdp = cmdlookup(name, 0)) == NULL ||
+	    cmdp->cmdtype != CMDFUNCTION)
+		sh_error("%s not defined in %s", name, fullname);
+	stunalloc(fullname);
+	goto success;
+
 builtin_success:
 	if (!updatetbl) {
 		entry->cmdtype = CMDBUILTIN;
@@ -478,6 +554,184 @@ success:
 
 
 
+/*
+ * Check whether fullname, a directory searched for a command followed by
+ * the command name, may exist without going to the file system.  The
+ * names in each directory are read once and checked again only when its
+ * modification time changes, so that a command which is not found, or is
+ * found in a later directory, does not cost a stat() per directory.  As
+ * checking the modification time is itself a stat(), it is only done the
+ * first time a directory is looked at after pathgen is incremented, which
+ * happens whenever a child process terminates or the shell creates a file.
+ */
+
+static unsigned
+namehash(const char *p)
+{
+	unsigned hashval = 2166136261u;
+
+	while (*p)
+		hashval = (hashval ^ (unsigned char)*p++) * 16777619;
+	return hashval;
+}
+
+
+static void
+indexdir(struct pathdir *pd, const struct stat *sb)
+{
+	DIR *dirp;
+	struct dirent *dp;
+	char *names = NULL;
+	size_t used = 0, size = 0, len, off;
+	unsigned count = 0, mask, h;
+
+	if (pd->table != noentries)
+		ckfree(pd->table);
+	ckfree(pd->names);
+	pd->table = NULL;
+	pd->names = NULL;
+	pd->dev = sb->st_dev;
+	pd->ino = sb->st_ino;
+#ifdef HAVE_ST_MTIM
+	pd->sec = sb->st_mtim.tv_sec;
+	pd->nsec = sb->st_mtim.tv_nsec;
+#else
+	pd->sec = sb->st_mtime;
+	pd->nsec = 0;
+#endif
+	if ((dirp = opendir(pd->path)) == NULL)
+		return;
+	while ((dp = readdir(dirp)) != NULL) {
+		len = strlen(dp->d_name) + 1;
+		if (used + len > size) {
+			size = (size + len) * 2;
+			names = ckrealloc(names, size);
+		}
+		memcpy(names + used, dp->d_name, len);
+		used += len;
+		count++;
+	}
+	closedir(dirp);
+
+	for (mask = 15; mask < count * 2; mask = mask * 2 + 1);
+	pd->table = ckmalloc((mask + 1) * sizeof(*pd->table));
+	memset(pd->table, 0, (mask + 1) * sizeof(*pd->table));
+	pd->mask = mask;
+	pd->names = names;
+	for (off = 0; off < used; off += strlen(names + off) + 1) {
+		h = namehash(names + off) & mask;
+		while (pd->table[h])
+			h = (h + 1) & mask;
+		pd->table[h] = off + 1;
+	}
+
+	/*
+	 * A file created later in the same second as the last change may not
+	 * change the modification time, so such an index is never trusted
+	 * past the current generation.
+	 */
+	if (pd->sec >= time(NULL) - 1)
+		pd->sec = -1;
+}
+
+
+/*
+ * Check the directory of an index and index it again if it has changed.
+ */
+
+static void
+pathdircheck(struct pathdir *pd)
+{
+	struct stat sb;
+
+	pd->checked = time(NULL);
+	if (stat(pd->path, &sb) < 0) {
+		if (pd->table != noentries)
+			ckfree(pd->table);
+		ckfree(pd->names);
+		pd->names = NULL;
+		pd->table = NULL;
+		pd->sec = -1;
+		if (errno == ENOENT || errno == ENOTDIR) {
+			pd->table = noentries;
+			pd->mask = 0;
+		}
+	} else if (pd->sec != sb.st_mtime ||
+#ifdef HAVE_ST_MTIM
+		   pd->nsec != sb.st_mtim.tv_nsec ||
+#endif
+		   pd->dev != sb.st_dev || pd->ino != sb.st_ino)
+		indexdir(pd, &sb);
+}
+
+
+static int
+pathdirlookup(struct pathdir *pd, const char *name)
+{
+	unsigned h, off;
+
+	if (!pd->table)
+		return 1;
+	for (h = namehash(name) & pd->mask; (off = pd->table[h]);
+	     h = (h + 1) & pd->mask)
+		if (equal(pd->names + off - 1, name))
+			return 1;
+	return 0;
+}
+
+
+static int
+pathdirhas(char *fullname, const char *name)
+{
+	struct pathdir *pd, **pdp;
+	size_t dirlen = strlen(fullname) - strlen(name);
+	int checked = 0;
+	int rv;
+
+	INTOFF;
+	for (pdp = &pathdirs; (pd = *pdp); pdp = &pd->next)
+		if (!strncmp(pd->path, fullname, dirlen) && !pd->path[dirlen])
+			break;
+	if (!pd) {
+		pd = ckmalloc(sizeof(*pd) - ARB + dirlen + 1);
+		memcpy(pd->path, fullname, dirlen);
+		pd->path[dirlen] = '\0';
+		pd->gen = pathgen - 1;
+		pd->checked = 0;
+		pd->sec = -1;
+		pd->table = NULL;
+		pd->names = NULL;
+		pd->next = NULL;
+		*pdp = pd;
+	}
+
+	if (pd->gen != pathgen) {
+		pd->gen = pathgen;
+		pathdircheck(pd);
+		checked = 1;
+	}
+
+	rv = pathdirlookup(pd, name);
+	/*
+	 * Another process may have added the command since the directory was
+	 * last checked, so on a miss the directory is checked again, but no
+	 * more than once a second.  An index made too recently to tell from
+	 * the modification time is not believed at all.
+	 */
+	if (!rv && !checked) {
+		if (pd->sec == -1 && pd->table != noentries)
+			rv = 1;
+		else if (pd->checked != time(NULL)) {
+			pathdircheck(pd);
+			rv = pathdirlookup(pd, name);
+		}
+	}
+	INTON;
+	return rv;
+}
+
+
+
 /*
  * Search the table of builtin commands.
  */
@@ -496,9 +750,60 @@ find_builtin(const char *name)
 
 
 
+/*
+ * Stat (or, if lnk is set, lstat) a file, using the result of an earlier
+ * call when it can still be trusted.
+ */
+
+int
+cachedstat(const char *name, struct stat *sb, int lnk)
+{
+	struct statentry *se;
+	size_t len;
+	int err;
+
+	len = strlen(name);
+	if (len >= sizeof(se->name))
+		return lnk ? lstat(name, sb) : stat(name, sb);
+
+	se = &statcache[(namehash(name) + lnk) % STATCACHESIZE];
+	if (se->gen == statgen && se->pgen == pathgen && se->lnk == lnk &&
+	    !strcmp(se->name, name)) {
+		if (se->err) {
+			errno = se->err;
+			return -1;
+		}
+		*sb = se->sb;
+		return 0;
+	}
+
+	err = (lnk ? lstat(name, sb) : stat(name, sb)) ? errno : 0;
+	if (err == EINTR)
+		return -1;
+
+	INTOFF;
+	se->gen = statgen;
+	se->pgen = pathgen;
+	se->lnk = lnk;
+	se->err = err;
+	if (!err)
+		se->sb = *sb;
+	memcpy(se->name, name, len + 1);
+	INTON;
+
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+
+
 /*
  * Called when a cd is done.  Marks all commands so the next time they
- * are executed they will be rehashed.
+ * are executed they will be rehashed.  Cached stat results for relative
+ * names are no longer good either.
  */
 
 void
@@ -507,6 +812,8 @@ hashcd(void)
 	struct tblentry **pp;
 	struct tblentry *cmdp;
 
+	statgen++;
+
 	for (pp = cmdtable ; pp < &cmdtable[CMDTABLESIZE] ; pp++) {
 		for (cmdp = *pp ; cmdp ; cmdp = cmdp->next) {
 			if (cmdp->cmdtype == CMDNORMAL)
@@ -527,7 +834,15 @@ hashcd(void)
 void
 changepath(const char *newval)
 {
-	clearcmdentry();
+	const char *oldval = pathval();
+	size_t len = strlen(oldval);
+
+	/*
+	 * Directories added to the end of PATH cannot change where the
+	 * commands already in the table are found.
+	 */
+	if (strncmp(newval, oldval, len) || (newval[len] && newval[len] != ':'))
+		clearcmdentry();
 }
 
 
@@ -623,21 +938,29 @@ delete_cmd_entry(void)
 
 
 
-#ifdef notdef
+/*
+ * Find a function or builtin without searching PATH or FPATH or changing
+ * the table.  Anything else is CMDUNKNOWN.
+ */
+
 void
-getcmdentry(char *name, struct cmdentry *entry)
+getcmdentry(const char *name, struct cmdentry *entry)
 {
 	struct tblentry *cmdp = cmdlookup(name, 0);
+	struct builtincmd *bcmd;
 
-	if (cmdp) {
+	if (cmdp && (cmdp->cmdtype == CMDFUNCTION ||
+		     cmdp->cmdtype == CMDBUILTIN)) {
 		entry->u = cmdp->param;
 		entry->cmdtype = cmdp->cmdtype;
+	} else if ((bcmd = find_builtin(name))) {
+		entry->u.cmd = bcmd;
+		entry->cmdtype = CMDBUILTIN;
 	} else {
 		entry->cmdtype = CMDUNKNOWN;
 		entry->u.index = 0;
 	}
 }
-#endif
 
 
 /*
@@ -691,6 +1014,45 @@ unsetfunc(const char *name)
 		delete_cmd_entry();
 }
 
+
+/*
+ * Add up the entries of the command table, the functions they hold and
+ * the names in the indexes of PATH directories for meminfo.
+ */
+
+void
+cmdmemuse(struct memuse *cmds, struct memuse *funcs, struct memuse *dirs)
+{
+	struct tblentry **pp;
+	struct tblentry *cmdp;
+	struct pathdir *pd;
+	unsigned h;
+
+	for (pp = cmdtable ; pp < &cmdtable[CMDTABLESIZE] ; pp++) {
+		for (cmdp = *pp ; cmdp ; cmdp = cmdp->next) {
+			cmds->count++;
+			cmds->bytes += sizeof(*cmdp) - ARB +
+				       strlen(cmdp->cmdname) + 1;
+			if (cmdp->cmdtype == CMDFUNCTION) {
+				funcs->count++;
+				funcs->bytes += funcsize(cmdp->param.func);
+			}
+		}
+	}
+	for (pd = pathdirs; pd; pd = pd->next) {
+		dirs->bytes += sizeof(*pd) - ARB + strlen(pd->path) + 1;
+		if (!pd->table || pd->table == noentries)
+			continue;
+		dirs->bytes += (pd->mask + 1) * sizeof(*pd->table);
+		for (h = 0; h <= pd->mask; h++) {
+			if (!pd->table[h])
+				continue;
+			dirs->count++;
+			dirs->bytes += strlen(pd->names + pd->table[h] - 1) + 1;
+		}
+	}
+}
+
 /*
  * Locate and print what a word is...
  */
@@ -68,19 +68,24 @@ struct cmdentry {
 
 union node;
 
+extern unsigned pathgen;	/* incremented when a command may have appeared */
+extern unsigned statgen;	/* incremented to drop cached stat results */
+
 void shellexec(char **, const char *, int)
     attribute((noreturn));
 int padvance(const char **, const char **, const char *);
 int hashcmd(int, char **);
 int find_command(char *, struct cmdentry *, int, const char *, const char *);
 struct builtincmd *find_builtin(const char *);
+struct stat;
+int cachedstat(const char *, struct stat *, int);
 void hashcd(void);
 void changepath(const char *);
-#ifdef notdef
-void getcmdentry(char *, struct cmdentry *);
-#endif
+void getcmdentry(const char *, struct cmdentry *);
 void defun(union node *);
 void unsetfunc(const char *);
+struct memuse;
+void cmdmemuse(struct memuse *, struct memuse *, struct memuse *);
 int typecmd(int, char **);
 int commandcmd(int, char **);
 
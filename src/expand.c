@@ -42,6 +42,8 @@
 #include <dirent.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 #ifdef HAVE_GETPWNAM
 #include <pwd.h>
 #endif
@@ -67,6 +69,7 @@
 #include "main.h"
 #include "nodes.h"
 #include "eval.h"
+#include "exec.h"
 #include "expand.h"
 #include "syntax.h"
 #include "parser.h"
@@ -80,6 +83,7 @@
 #include "mystring.h"
 #include "show.h"
 #include "system.h"
+#include "trap.h"
 
 /*
  * pmatch() flags
@@ -117,10 +121,37 @@ static struct ifsregion *ifslastp;
 /* holds expanded arg list */
 static struct arglist exparg;
 
+/*
+ * Command substitutions in prompts that run out of time are left running
+ * and their last complete output is shown instead.  Each is identified by
+ * the prompt it appears in and its position there.
+ */
+struct promptsub {
+	struct promptsub *next;
+	char *src;		/* text of the prompt */
+	int no;			/* which substitution in it */
+	int fd;			/* pipe from a run still in progress, or -1 */
+	char *val;		/* last complete output */
+	size_t len;
+	char *buf;		/* output of the run in progress */
+	size_t nbuf;
+};
+
+#define PROMPTSUBMAX 8
+
+static struct promptsub *promptsubs;
+static const char *promptsrc;	/* prompt being expanded */
+static int promptsubno;		/* substitutions expanded in it so far */
+
 static char *argstr(char *, int);
+static void traceexpand(union node *, intmax_t);
 static char *exptilde(char *, char *, int);
 static char *expari(char *, int);
 static void expbackq(union node *, int);
+static intmax_t cmdsubtimeout(int);
+static int waitinput(int, intmax_t);
+static struct promptsub *getpromptsub(void);
+static int readpromptsub(struct promptsub *, intmax_t);
 static const char *subevalvar(char *, char *, int, int, int, int, int);
 static char *evalvar(char *, int);
 static size_t strtodest(const char *, int);
@@ -173,6 +204,7 @@ expandarg(union node *arg, struct arglist *arglist, int flags)
 {
 	struct strlist *sp;
 	char *p;
+	intmax_t tracestart = etracefd >= 0 ? etracenow() : 0;
 
 	argbackq = arg->narg.backquote;
 	STARTSTACKSTR(expdest);
@@ -213,11 +245,63 @@ expandarg(union node *arg, struct arglist *arglist, int flags)
 		arglist->lastp = exparg.lastp;
 	}
 
+	if (tracestart && etracenow() - tracestart >= etraceexp)
+		traceexpand(arg, tracestart);
+
 out:
 	ifsfree();
 }
 
 
+/*
+ * Expand the word of a redirection while another word is being expanded,
+ * as for $(<file), and return it.  The state of the outer expansion is
+ * kept; the word should contain no command substitution.
+ */
+
+char *
+expandredir(union node *arg)
+{
+	struct nodelist *saveargbackq = argbackq;
+	struct ifsregion saveifsfirst = ifsfirst;
+	struct ifsregion *saveifslastp = ifslastp;
+	struct arglist saveexparg = exparg;
+	char *saveexpdest = expdest;
+	struct arglist fn;
+
+	ifsfirst.next = NULL;
+	ifslastp = NULL;
+	fn.lastp = &fn.list;
+	expandarg(arg, &fn, EXP_TILDE | EXP_REDIR);
+	argbackq = saveargbackq;
+	ifsfirst = saveifsfirst;
+	ifslastp = saveifslastp;
+	exparg = saveexparg;
+	expdest = saveexpdest;
+	return fn.list->text;
+}
+
+
+
+/*
+ * Record a slow expansion in the execution trace.
+ */
+
+static void
+traceexpand(union node *arg, intmax_t start)
+{
+	char *word;
+
+	INTOFF;
+	word = commandtext(arg);
+	etraceint("dur", etracebegin("expand") - start);
+	etracestr("word", word);
+	etraceend();
+	ckfree(word);
+	INTON;
+}
+
+
 
 /*
  * Perform variable and command substitution.  If EXP_FULL is set, output CTLESC
@@ -480,45 +564,111 @@ static void
 expbackq(union node *cmd, int flags)
 {
 	struct backcmd in;
+	struct promptsub *ps = NULL;
+	intmax_t timeout;
+	intmax_t deadline = 0;
+	int timedout = 0;
 	int i;
 	char buf[128];
-	char *p;
 	char *dest;
 	int startloc;
 	struct stackmark smark;
+	jmp_buf *volatile savehandler = NULL;
+	jmp_buf jmploc;
 
 	INTOFF;
 	startloc = expdest - (char *)stackblock();
+	timeout = cmdsubtimeout(flags);
+	if (timeout >= 0) {
+		deadline = etracenow() + timeout * 1000;
+		if (flags & EXP_PROMPT)
+			ps = getpromptsub();
+	}
+	if (ps && ps->fd >= 0) {
+		/* The last run is still going; show what it left before. */
+		readpromptsub(ps, 0);
+		goto cached;
+	}
+	if (timeout >= 0 && !ps) {
+		/*
+		 * The substitution gets a process group of its own so that
+		 * all of it can be stopped, and the terminal no longer sends
+		 * it SIGINT; catch that here and pass it on.
+		 */
+		catchint++;
+		setsignal(SIGINT, 0);
+		savehandler = handler;
+		if (setjmp(jmploc)) {
+			handler = savehandler;
+			catchint--;
+			setsignal(SIGINT, 0);
+			longjmp(*handler, 1);
+		}
+		handler = &jmploc;
+	}
 	pushstackmark(&smark, startloc);
-	evalbackcmd(cmd, flags & EXP_XTRACE ? EV_XTRACE : 0, &in);
+	evalbackcmd(cmd, (flags & EXP_XTRACE ? EV_XTRACE : 0) |
+			 (timeout >= 0 ? EV_PGRP : 0), &in);
 	popstackmark(&smark);
+	if (savehandler)
+		handler = savehandler;
 
-	p = in.buf;
-	i = in.nleft;
-	if (i == 0)
-		goto read;
-	for (;;) {
-		memtodest(p, i, flags & (QUOTES_ESC | EXP_QUOTED));
-read:
-		if (in.fd < 0)
+	if (ps && in.jp) {
+		ps->fd = in.fd;
+		if (readpromptsub(ps, deadline))
+			back_exitstatus = waitforjob(in.jp);
+		else {
+			i = fcntl(ps->fd, F_DUPFD_CLOEXEC, 10);
+			if (i >= 0) {
+				close(ps->fd);
+				ps->fd = i;
+			}
+			detachjob(in.jp);
+		}
+cached:
+		memtodest(ps->val, ps->len, flags & (QUOTES_ESC | EXP_QUOTED));
+		INTON;
+		goto trim;
+	}
+
+	if (in.nleft)
+		memtodest(in.buf, in.nleft, flags & (QUOTES_ESC | EXP_QUOTED));
+	while (in.fd >= 0) {
+		if (timeout >= 0 && !waitinput(in.fd, deadline)) {
+			timedout = 1;
 			break;
+		}
 		do {
 			i = read(in.fd, buf, sizeof buf);
 		} while (i < 0 && errno == EINTR);
 		TRACE(("expbackq: read returns %d\n", i));
 		if (i <= 0)
 			break;
-		p = buf;
+		memtodest(buf, i, flags & (QUOTES_ESC | EXP_QUOTED));
 	}
 
 	if (in.buf)
 		ckfree(in.buf);
 	if (in.fd >= 0) {
 		close(in.fd);
-		back_exitstatus = waitforjob(in.jp);
+		if (timedout) {
+			if (in.jp) {
+				/* It may be stopped for using the terminal. */
+				killpg(in.jp->ps->pid, SIGTERM);
+				killpg(in.jp->ps->pid, SIGCONT);
+				detachjob(in.jp);
+			}
+			back_exitstatus = 124;
+		} else if (in.jp)
+			back_exitstatus = waitforjob(in.jp);
+	}
+	if (timeout >= 0 && !ps) {
+		catchint--;
+		setsignal(SIGINT, 0);
 	}
 	INTON;
 
+trim:
 	/* Eat all trailing newlines */
 	dest = expdest;
 	for (; dest > (char *)stackblock() + startloc && dest[-1] == '\n';)
@@ -534,6 +684,141 @@ read:
 }
 
 
+/*
+ * Return the time in milliseconds a command substitution may take, or -1
+ * if there is no limit.  Substitutions in prompts are governed by
+ * PROMPTTIMEOUT if it is set.
+ */
+
+static intmax_t
+cmdsubtimeout(int flags)
+{
+	const char *val = NULL;
+
+	if (flags & EXP_PROMPT)
+		val = lookupvar("PROMPTTIMEOUT");
+	if (!val)
+		val = lookupvar("CMDSUBTIMEOUT");
+	return val && is_number(val) ? atomax10(val) : -1;
+}
+
+
+/*
+ * Wait for input on fd until the deadline, as returned by etracenow().
+ * Returns zero if none arrived in time or an interrupt is pending.
+ */
+
+static int
+waitinput(int fd, intmax_t deadline)
+{
+	struct pollfd pfd;
+	intmax_t left;
+	int n;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	do {
+		left = deadline - etracenow();
+		if (left < 0)
+			left = 0;
+		n = poll(&pfd, 1, left > INT_MAX / 1000 ? INT_MAX :
+				  (int)((left + 999) / 1000));
+	} while (n < 0 && errno == EINTR && !int_pending());
+	return n != 0 && !int_pending();
+}
+
+
+/*
+ * Called before a prompt is expanded, to tell its command substitutions
+ * apart from those of other prompts.
+ */
+
+void
+startprompt(const char *src)
+{
+	promptsrc = src;
+	promptsubno = 0;
+}
+
+
+/*
+ * Find the entry for the next command substitution in the prompt being
+ * expanded, making one if needed.  Only the most recent PROMPTSUBMAX are
+ * kept.
+ */
+
+static struct promptsub *
+getpromptsub(void)
+{
+	struct promptsub **pp, **lastp = NULL;
+	struct promptsub *ps;
+	int no = promptsubno++;
+	int n = 0;
+
+	for (pp = &promptsubs; (ps = *pp); pp = &ps->next) {
+		if (ps->no == no && !strcmp(ps->src, promptsrc))
+			return ps;
+		lastp = pp;
+		n++;
+	}
+	if (n >= PROMPTSUBMAX) {
+		ps = *lastp;
+		*lastp = NULL;
+		if (ps->fd >= 0)
+			close(ps->fd);
+		ckfree(ps->src);
+		ckfree(ps->val);
+		ckfree(ps->buf);
+		ckfree(ps);
+	}
+	ps = ckmalloc(sizeof(*ps));
+	ps->src = savestr(promptsrc);
+	ps->no = no;
+	ps->fd = -1;
+	ps->val = NULL;
+	ps->len = 0;
+	ps->buf = NULL;
+	ps->nbuf = 0;
+	ps->next = promptsubs;
+	promptsubs = ps;
+	return ps;
+}
+
+
+/*
+ * Collect the output of a prompt substitution until the deadline.  At end
+ * of file the output becomes the value shown and 1 is returned.
+ */
+
+static int
+readpromptsub(struct promptsub *ps, intmax_t deadline)
+{
+	char buf[128];
+	int i;
+
+	for (;;) {
+		if (!waitinput(ps->fd, deadline))
+			return 0;
+		do {
+			i = read(ps->fd, buf, sizeof buf);
+		} while (i < 0 && errno == EINTR);
+		if (i <= 0)
+			break;
+		ps->buf = ckrealloc(ps->buf, ps->nbuf + i);
+		memcpy(ps->buf + ps->nbuf, buf, i);
+		ps->nbuf += i;
+	}
+	close(ps->fd);
+	ps->fd = -1;
+	ckfree(ps->val);
+	ps->val = ps->buf;
+	ps->len = ps->nbuf;
+	ps->buf = NULL;
+	ps->nbuf = 0;
+	return 1;
+}
+
+
 static const char *
 subevalvar(char *p, char *str, int strloc, int subtype, int startloc, int varflags, int flags)
 {
@@ -1247,7 +1532,7 @@ expmeta1(char *expdir, char *enddir, char *name, int flags)
 #ifdef ENABLE_INTERNAL_COMPLETION
 		if (!(flags & EXP_COMPLETE))
 #endif
-			res = lstat(expdir, &statb);
+			res = cachedstat(expdir, &statb, 1);
 		if (res >= 0)
 			addfname(expdir);
 #ifdef ENABLE_INTERNAL_COMPLETION
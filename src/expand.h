@@ -63,6 +63,7 @@ struct arglist {
 #define EXP_VARTILDE	0x8	/* expand tildes in an assignment */
 #define EXP_REDIR	0x10	/* file glob for a redirection (1 match only) */
 #define EXP_CASE	0x20	/* keeps quotes around for CASE pattern */
+#define EXP_PROMPT	0x40	/* expand prompt; time limit from PROMPTTIMEOUT */
 #define EXP_WORD	0x80	/* expand word in parameter expansion */
 #define EXP_QUOTED	0x100	/* expand word in double quotes */
 #define EXP_DISCARD	0x200	/* discard result of expansion */
@@ -79,10 +80,12 @@ struct arglist {
 
 union node;
 void expandarg(union node *, struct arglist *, int);
+char *expandredir(union node *);
 #define rmescapes(p) _rmescapes((p), 0)
 char *_rmescapes(char *, int);
 int casematch(union node *, char *);
 void recordregion(int, int, int);
+void startprompt(const char *);
 void removerecordregions(int); 
 void ifsbreakup(char *, int, struct arglist *);
 void ifsfree(void);
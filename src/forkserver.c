@@ -0,0 +1,694 @@
+/*-
+ * Copyright (c) 2026
+ *	The gwsh authors.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+/*
+ * Fork server.  The forkserver builtin turns a shell that has already
+ * read its profiles and function libraries into a server listening on a
+ * Unix socket.  A shell started with FORKSERVER set to the name of such a
+ * socket to run a command string or script does not initialize itself; it
+ * passes its standard descriptors, current directory, umask, resource
+ * limits, arguments and environment to the server and waits.  Login,
+ * interactive and set-user-ID shells, and shells that have descriptors
+ * open besides the standard ones, start as usual.  The server only
+ * accepts connections from its own user.  The server forks a child for each client, which takes these
+ * over and runs the command line as a freshly started shell would, and
+ * sends the child's exit status back once it has reaped it.
+ *
+ * The client sends a struct fsrequest carrying FSNFDS descriptors,
+ * followed by len bytes holding argc arguments and then envc environment
+ * strings, each terminated by a nul.  The child answers with its pid, and
+ * the server with the wait status.
+ */
+
+#include "shell.h"
+#include "forkserver.h"
+#include "cd.h"
+#include "error.h"
+#include "eval.h"
+#include "jobs.h"
+#include "main.h"
+#include "memalloc.h"
+#include "options.h"
+#include "output.h"
+#include "trap.h"
+#include "var.h"
+#include "system.h"
+
+
+/* standard input, output, error and the current directory */
+#define FSNFDS 4
+
+/* upper bound on the size of a request */
+#define FSMAXLEN (16 * 1024 * 1024)
+
+/* resource limits passed on to the child */
+static const int fslimits[] = {
+#ifdef RLIMIT_CPU
+	RLIMIT_CPU,
+#endif
+#ifdef RLIMIT_FSIZE
+	RLIMIT_FSIZE,
+#endif
+#ifdef RLIMIT_DATA
+	RLIMIT_DATA,
+#endif
+#ifdef RLIMIT_STACK
+	RLIMIT_STACK,
+#endif
+#ifdef RLIMIT_CORE
+	RLIMIT_CORE,
+#endif
+#ifdef RLIMIT_RSS
+	RLIMIT_RSS,
+#endif
+#ifdef RLIMIT_MEMLOCK
+	RLIMIT_MEMLOCK,
+#endif
+#ifdef RLIMIT_NPROC
+	RLIMIT_NPROC,
+#endif
+#ifdef RLIMIT_NOFILE
+	RLIMIT_NOFILE,
+#endif
+#ifdef RLIMIT_AS
+	RLIMIT_AS,
+#endif
+#ifdef RLIMIT_LOCKS
+	RLIMIT_LOCKS,
+#endif
+#ifdef RLIMIT_RTPRIO
+	RLIMIT_RTPRIO,
+#endif
+};
+
+#define FSNLIMITS (sizeof(fslimits) / sizeof(fslimits[0]))
+
+struct fsrequest {
+	int argc;
+	int envc;
+	size_t len;		/* bytes of strings that follow */
+	mode_t mask;		/* file creation mask */
+	pid_t ppid;		/* parent of the client */
+	struct rlimit limits[FSNLIMITS];
+};
+
+struct fsclient {
+	pid_t pid;		/* child running the request */
+	int fd;			/* connection to send the status to */
+};
+
+
+static struct fsclient *clients;
+static int nclients;
+static int listenfd = -1;
+
+/* the client's child, which gets the signals sent to the client */
+static volatile pid_t fspid;
+
+
+extern char **environ;
+
+static int fsdelegable(char **);
+static int fsextrafds(void);
+static void fsforward(int);
+static int fspeerok(int);
+static void fschild(int) attribute((noreturn));
+static void fsreap(void);
+static void fssend(int, int);
+static int readfull(int, void *, size_t);
+
+
+/*
+ * Called before the shell is initialized.  If FORKSERVER names a socket
+ * that accepts the connection, run the command line there and exit with
+ * its status; otherwise return and let the shell start as usual.
+ */
+
+void
+forkclient(int argc, char **argv)
+{
+	static const int sigs[] = {
+		SIGHUP, SIGINT, SIGQUIT, SIGTERM, SIGUSR1, SIGUSR2
+	};
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(FSNFDS * sizeof(int))];
+	} cm;
+	struct sockaddr_un sun;
+	struct fsrequest rq;
+	struct sigaction act;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmp;
+	const char *path;
+	char **ap;
+	char *buf, *p;
+	int fds[FSNFDS];
+	int status;
+	size_t len;
+	size_t i;
+	pid_t pid;
+	int fd;
+
+	path = getenv("FORKSERVER");
+	if (!path || !*path || strlen(path) >= sizeof(sun.sun_path))
+		return;
+	for (i = 0; i < 3; i++)
+		if (fcntl(i, F_GETFD) < 0)
+			return;
+	if (!fsdelegable(argv))
+		return;
+	for (i = 0; i < FSNLIMITS; i++)
+		if (getrlimit(fslimits[i], &rq.limits[i]) < 0)
+			return;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+	fds[3] = -1;
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return;
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+		goto fail;
+	fds[3] = open(".", O_RDONLY | O_DIRECTORY);
+	if (fds[3] < 0)
+		goto fail;
+	for (i = 0; i < 3; i++)
+		fds[i] = i;
+
+	rq.argc = argc;
+	rq.envc = 0;
+	len = 0;
+	for (ap = argv; *ap; ap++)
+		len += strlen(*ap) + 1;
+	for (ap = environ; *ap; ap++, rq.envc++)
+		len += strlen(*ap) + 1;
+	rq.len = len;
+	rq.mask = umask(0);
+	umask(rq.mask);
+	rq.ppid = getppid();
+	if (len > FSMAXLEN || !(buf = malloc(len + 1)))
+		goto fail;
+	p = buf;
+	for (ap = argv; *ap; ap++)
+		p = stpcpy(p, *ap) + 1;
+	for (ap = environ; *ap; ap++)
+		p = stpcpy(p, *ap) + 1;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&cm, 0, sizeof(cm));
+	iov.iov_base = &rq;
+	iov.iov_len = sizeof(rq);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cm.buf;
+	msg.msg_controllen = sizeof(cm.buf);
+	cmp = CMSG_FIRSTHDR(&msg);
+	cmp->cmsg_level = SOL_SOCKET;
+	cmp->cmsg_type = SCM_RIGHTS;
+	cmp->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmp), fds, sizeof(fds));
+	i = sendmsg(fd, &msg, 0) != sizeof(rq) || xwrite(fd, buf, len) < 0;
+	free(buf);
+	if (i)
+		goto fail;
+	close(fds[3]);
+	fds[3] = -1;
+
+	/* Nothing has run unless the child reports its pid. */
+	if (readfull(fd, &pid, sizeof(pid)) < 0)
+		goto fail;
+	fspid = pid;
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = fsforward;
+	sigfillset(&act.sa_mask);
+	for (i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++) {
+		struct sigaction old;
+
+		/* Signals ignored by the client stay ignored. */
+		if (sigaction(sigs[i], NULL, &old) == 0 &&
+		    old.sa_handler != SIG_IGN)
+			sigaction(sigs[i], &act, NULL);
+	}
+
+	if (readfull(fd, &status, sizeof(status)) < 0)
+		_exit(255);
+	if (WIFSIGNALED(status)) {
+		signal(WTERMSIG(status), SIG_DFL);
+		raise(WTERMSIG(status));
+		_exit(128 + WTERMSIG(status));
+	}
+	_exit(WEXITSTATUS(status));
+
+fail:
+	if (fds[3] >= 0)
+		close(fds[3]);
+	close(fd);
+}
+
+
+/*
+ * Return whether a shell with these arguments may be run by the server:
+ * it is not a login shell and runs a command string or a script with no
+ * options beyond a harmless few, and neither it nor its user ID is
+ * special.
+ */
+
+static int
+fsdelegable(char **argv)
+{
+	const char *p;
+	int cmdstr = 0;
+
+	if (getuid() != geteuid() || getgid() != getegid() || **argv == '-')
+		return 0;
+	while ((p = *++argv) && (*p == '-' || *p == '+')) {
+		if (!p[1] || !strcmp(p, "--")) {
+			argv++;
+			break;
+		}
+		if (p[strspn(p + 1, "aCcefnuvx") + 1])
+			return 0;
+		if (*p == '-' && strchr(p, 'c'))
+			cmdstr = 1;
+	}
+	if (!cmdstr && !*argv)
+		return 0;
+	return !fsextrafds();
+}
+
+
+/*
+ * Return whether descriptors beyond the standard ones are open, which the
+ * server's child would not have.
+ */
+
+static int
+fsextrafds(void)
+{
+	struct dirent *dp;
+	struct rlimit rl;
+	DIR *dirp;
+	int found = 0;
+	int fd;
+
+	if ((dirp = opendir("/proc/self/fd"))) {
+		while ((dp = readdir(dirp)))
+			if ((fd = atoi(dp->d_name)) > 2 && fd != dirfd(dirp)) {
+				found = 1;
+				break;
+			}
+		closedir(dirp);
+		return found;
+	}
+	if (getrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_cur == RLIM_INFINITY)
+		return 1;
+	for (fd = 3; fd < (int)rl.rlim_cur; fd++)
+		if (fcntl(fd, F_GETFD) >= 0)
+			return 1;
+	return 0;
+}
+
+
+static void
+fsforward(int signo)
+{
+	kill(fspid, signo);
+}
+
+
+/*
+ * Return whether the peer of a connection runs as the same user.
+ */
+
+static int
+fspeerok(int fd)
+{
+#ifdef HAVE_GETPEEREID
+	uid_t uid;
+	gid_t gid;
+
+	return !getpeereid(fd, &uid, &gid) && uid == geteuid();
+#elif defined(SO_PEERCRED)
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	return !getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) &&
+	       cred.uid == geteuid();
+#else
+	return 0;
+#endif
+}
+
+
+/*
+ * Read exactly len bytes.  Returns -1 on end of file or error.
+ */
+
+static int
+readfull(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = read(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+
+/*
+ * The forkserver builtin.  Serves clients until a signal or a trap ends
+ * the shell; traps that do not exit are run in between.
+ */
+
+int
+forkservercmd(int argc, char **argv)
+{
+	struct sockaddr_un sun;
+	struct pollfd pfd;
+	struct stat st;
+	const char *path;
+	int conn;
+	int fd;
+	pid_t pid;
+
+	nextopt(nullstr);
+	path = *argptr;
+	if (!path || argptr[1])
+		sh_error("usage: forkserver socket");
+	if (strlen(path) >= sizeof(sun.sun_path))
+		sh_error("%s: name too long", path);
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		sh_error("socket: %s", errnomsg());
+	if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0 ||
+	    listen(fd, SOMAXCONN) < 0) {
+		close(fd);
+		sh_error("%s: %s", path, errnomsg());
+	}
+	INTOFF;
+	/* left behind if a trap ended the last call with an exception */
+	if (listenfd >= 0)
+		close(listenfd);
+	listenfd = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+	close(fd);
+	INTON;
+	if (listenfd < 0)
+		sh_error("%s: %s", path, errnomsg());
+
+	pfd.fd = listenfd;
+	pfd.events = POLLIN;
+	flushall();
+	for (;;) {
+		/*
+		 * Keep signals blocked except while waiting, so that a
+		 * SIGCHLD cannot slip in between reaping and polling.
+		 */
+		sigprocmask(SIG_SETMASK, &sigset_full, 0);
+		fsreap();
+		if (pending_sig) {
+			sigprocmask(SIG_SETMASK, &sigset_empty, 0);
+			dotrap();
+			if (evalskip)
+				break;
+			continue;
+		}
+#ifdef HAVE_PPOLL
+		if (ppoll(&pfd, 1, NULL, &sigset_empty) <= 0)
+			continue;
+		sigprocmask(SIG_SETMASK, &sigset_empty, 0);
+#else
+		sigprocmask(SIG_SETMASK, &sigset_empty, 0);
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+#endif
+
+		conn = accept(listenfd, NULL, NULL);
+		if (conn < 0)
+			continue;
+		if (!fspeerok(conn)) {
+			close(conn);
+			continue;
+		}
+		INTOFF;
+		fd = fcntl(conn, F_DUPFD_CLOEXEC, 10);
+		close(conn);
+		if (fd < 0) {
+			INTON;
+			continue;
+		}
+		if (!(nclients & 15))
+			clients = ckrealloc(clients,
+					    (nclients + 16) * sizeof(*clients));
+		pid = forkshell(NULL, NULL, FORK_NOJOB);
+		if (pid == 0)
+			fschild(fd);
+		clients[nclients].pid = pid;
+		clients[nclients].fd = fd;
+		nclients++;
+		INTON;
+	}
+	sigprocmask(SIG_SETMASK, &sigset_empty, 0);
+
+	INTOFF;
+	close(listenfd);
+	listenfd = -1;
+	INTON;
+	return 0;
+}
+
+
+/*
+ * Send the status of every finished child to its client.  The table is
+ * searched by pid so that the shell's own jobs are left alone.
+ */
+
+static void
+fsreap(void)
+{
+	int status;
+	int i;
+
+	if (!gotsigchld)
+		return;
+	gotsigchld = 0;
+	for (i = 0; i < nclients; ) {
+		if (waitpid(clients[i].pid, &status, WNOHANG) <= 0) {
+			i++;
+			continue;
+		}
+		fssend(i, status);
+	}
+}
+
+
+/*
+ * Called by dowait for a child that is not one of the shell's jobs, which
+ * may be running a client's request when a trap or a command run by the
+ * server waits for any child.
+ */
+
+void
+fsdone(pid_t pid, int status)
+{
+	int i;
+
+	if (WIFSTOPPED(status))
+		return;
+	for (i = 0; i < nclients; i++)
+		if (clients[i].pid == pid) {
+			fssend(i, status);
+			break;
+		}
+}
+
+
+static void
+fssend(int i, int status)
+{
+	send(clients[i].fd, &status, sizeof(status), MSG_NOSIGNAL);
+	close(clients[i].fd);
+	clients[i] = clients[--nclients];
+}
+
+
+/*
+ * Run a client's request in a child of the server.
+ */
+
+static void
+fschild(int conn)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(FSNFDS * sizeof(int))];
+	} cm;
+	struct fsrequest rq;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmp;
+	char **argv, **env;
+	char *buf, *p, *end;
+	int fds[FSNFDS];
+	pid_t pid;
+	int i;
+
+	INTON;
+	close(listenfd);
+	listenfd = -1;
+	for (i = 0; i < nclients; i++)
+		close(clients[i].fd);
+	nclients = 0;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &rq;
+	iov.iov_len = sizeof(rq);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cm.buf;
+	msg.msg_controllen = sizeof(cm.buf);
+	if (recvmsg(conn, &msg, 0) != sizeof(rq) ||
+	    !(cmp = CMSG_FIRSTHDR(&msg)) || cmp->cmsg_level != SOL_SOCKET ||
+	    cmp->cmsg_type != SCM_RIGHTS ||
+	    cmp->cmsg_len != CMSG_LEN(sizeof(fds)))
+		_exit(127);
+	memcpy(fds, CMSG_DATA(cmp), sizeof(fds));
+	if (rq.argc < 1 || rq.envc < 0 || rq.len > FSMAXLEN)
+		_exit(127);
+
+	buf = ckmalloc(rq.len);
+	argv = ckmalloc((rq.argc + 1) * sizeof(*argv));
+	env = ckmalloc((rq.envc + 1) * sizeof(*env));
+	if (readfull(conn, buf, rq.len) < 0)
+		_exit(127);
+	p = buf;
+	end = buf + rq.len;
+	for (i = 0; i < rq.argc + rq.envc; i++) {
+		char *q = memchr(p, '\0', end - p);
+
+		if (!q)
+			_exit(127);
+		if (i < rq.argc)
+			argv[i] = p;
+		else
+			env[i - rq.argc] = p;
+		p = q + 1;
+	}
+	argv[rq.argc] = NULL;
+	env[rq.envc] = NULL;
+
+	/*
+	 * Take on the client's limits.  If a hard limit cannot be raised to
+	 * the client's, give up before reporting, so that the client runs
+	 * the command itself.
+	 */
+	for (i = 0; i < (int)FSNLIMITS; i++) {
+		struct rlimit rl;
+
+		if (getrlimit(fslimits[i], &rl) < 0 ||
+		    ((rl.rlim_cur != rq.limits[i].rlim_cur ||
+		      rl.rlim_max != rq.limits[i].rlim_max) &&
+		     setrlimit(fslimits[i], &rq.limits[i]) < 0))
+			_exit(127);
+	}
+
+	pid = getpid();
+	if (xwrite(conn, &pid, sizeof(pid)) < 0)
+		_exit(127);
+	close(conn);
+
+	/* Keep the received descriptors out of the way of dup2. */
+	for (i = 0; i < FSNFDS; i++) {
+		if (fds[i] < 3) {
+			int fd = fcntl(fds[i], F_DUPFD, 10);
+
+			close(fds[i]);
+			fds[i] = fd;
+		}
+	}
+	for (i = 0; i < 3; i++) {
+		dup2(fds[i], i);
+		close(fds[i]);
+	}
+
+	rootpid = pid;
+	funcnest = 0;
+	commandname = NULL;
+	/* A subshell still shows the traps of its parent; a new shell
+	 * has none. */
+	clear_traps();
+	umask(rq.mask);
+	adoptenv(env);
+	setvarint("PPID", rq.ppid, 0);
+	restorecwd(fds[3]);
+	setpwd(getpwd(0), 0);
+	freepwd();
+
+	freeparam(&shellparam);
+	shellparam.nparam = 0;
+	shellparam.malloc = 0;
+	memset(optlist, 0, sizeof(optlist));
+	procargs(rq.argc, argv);
+	if (minusc)
+		evalstring(minusc, (sflag ? 0 : EV_EXIT) | EV_LINENO);
+	if (sflag || minusc == NULL)
+		cmdloop(1);
+	exitshell();
+}
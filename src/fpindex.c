@@ -0,0 +1,538 @@
+/*-
+ * Copyright (c) 2026
+ *	The gwsh authors.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * Indexes of function libraries.  A directory in FPATH may hold a file
+ * named .fpindex, made by the fpindex builtin, with a line for each
+ * function defined in the files of the directory:
+ *
+ *	name file offset length line dev ino size sec nsec
+ *
+ * giving the file it is in, the byte offset and length of the text that
+ * defines it, the line that text starts on and the identity, size and
+ * modification time the file had when it was indexed.  When such a
+ * function is first called, only that text is read, rather than the whole
+ * of a file named after the function, and it is run only if the file is
+ * unchanged and the text does nothing but define the function; otherwise
+ * the function is looked for as if there were no index.  The index is
+ * read once and checked again with a stat() on each lookup.  Only
+ * directories given by absolute path names are indexed.
+ */
+
+#include "shell.h"
+#include "fpindex.h"
+#include "error.h"
+#include "eval.h"
+#include "exec.h"
+#include "input.h"
+#include "main.h"
+#include "memalloc.h"
+#include "mystring.h"
+#include "nodes.h"
+#include "options.h"
+#include "output.h"
+#include "parser.h"
+#include "system.h"
+
+#define FPINDEX ".fpindex"
+
+struct fpentry {
+	const char *name;	/* the function, or NULL if the slot is free */
+	const char *file;	/* the file holding it */
+	off_t off;		/* where its definition starts */
+	size_t len;		/* length of the definition */
+	int line;		/* line number of the start */
+	dev_t dev;		/* identity of the file when indexed */
+	ino_t ino;
+	off_t size;		/* its size */
+	time_t sec;		/* its modification time */
+	long nsec;
+};
+
+struct fpindex {
+	struct fpindex *next;
+	dev_t dev;		/* identity of the index file read */
+	ino_t ino;
+	time_t sec;		/* its modification time */
+	long nsec;
+	off_t size;
+	char *text;		/* its contents, split into fields */
+	struct fpentry *table;	/* hash table of the entries, or NULL */
+	unsigned mask;		/* size of table - 1 */
+	char path[];		/* the directory, with a trailing slash */
+};
+
+static struct fpindex *fpindexes;
+
+
+static void readindex(struct fpindex *, const struct stat *);
+static struct fpentry *findentry(struct fpindex *, const char *);
+static int loadentry(struct fpindex *, struct fpentry *);
+static int defunsonly(union node *, const char *);
+static int cmpstr(const void *, const void *);
+static void indexfile(struct output *, const char *, const char *);
+
+
+static unsigned
+fphash(const char *p)
+{
+	unsigned hashval = 2166136261u;
+
+	while (*p)
+		hashval = (hashval ^ (unsigned char)*p++) * 16777619u;
+	return hashval;
+}
+
+
+/*
+ * Define the function name from the index of the directory of fullname,
+ * which is a directory in FPATH followed by name.  Returns 0 if the
+ * directory has no index, or the index does not list the function or is
+ * out of date.
+ */
+
+int
+fpindexload(const char *fullname, const char *name)
+{
+	struct fpindex *ix, **ixp;
+	struct fpentry *ep;
+	size_t dirlen = strlen(fullname) - strlen(name);
+	struct stat sb;
+	char *p;
+
+	if (fullname[0] != '/')
+		return 0;
+
+	INTOFF;
+	for (ixp = &fpindexes; (ix = *ixp); ixp = &ix->next)
+		if (!strncmp(ix->path, fullname, dirlen) && !ix->path[dirlen])
+			break;
+	if (!ix) {
+		ix = ckmalloc(sizeof(*ix) + dirlen + 1);
+		memcpy(ix->path, fullname, dirlen);
+		ix->path[dirlen] = '\0';
+		ix->sec = -1;
+		ix->text = NULL;
+		ix->table = NULL;
+		ix->next = NULL;
+		*ixp = ix;
+	}
+
+	p = stalloc(dirlen + sizeof(FPINDEX));
+	memcpy(stpcpy(p, ix->path), FPINDEX, sizeof(FPINDEX));
+	if (stat(p, &sb) < 0) {
+		ckfree(ix->table);
+		ckfree(ix->text);
+		ix->table = NULL;
+		ix->text = NULL;
+		ix->sec = -1;
+	} else if (ix->sec != sb.st_mtime ||
+#ifdef HAVE_ST_MTIM
+		   ix->nsec != sb.st_mtim.tv_nsec ||
+#endif
+		   ix->dev != sb.st_dev || ix->ino != sb.st_ino ||
+		   ix->size != sb.st_size)
+		readindex(ix, &sb);
+	stunalloc(p);
+	ep = findentry(ix, name);
+	INTON;
+
+	return ep && loadentry(ix, ep);
+}
+
+
+/*
+ * Read the index file of a directory.  A line that cannot be made sense
+ * of is left out.  Called with interrupts off.
+ */
+
+static void
+readindex(struct fpindex *ix, const struct stat *sb)
+{
+	char *text, *p, *q, *end, *f[10];
+	struct fpentry *ep;
+	unsigned count, mask;
+	ssize_t n;
+	int fd;
+	int i;
+
+	ckfree(ix->table);
+	ckfree(ix->text);
+	ix->table = NULL;
+	ix->text = NULL;
+	ix->dev = sb->st_dev;
+	ix->ino = sb->st_ino;
+	ix->size = sb->st_size;
+#ifdef HAVE_ST_MTIM
+	ix->sec = sb->st_mtim.tv_sec;
+	ix->nsec = sb->st_mtim.tv_nsec;
+#else
+	ix->sec = sb->st_mtime;
+	ix->nsec = 0;
+#endif
+
+	p = stalloc(strlen(ix->path) + sizeof(FPINDEX));
+	memcpy(stpcpy(p, ix->path), FPINDEX, sizeof(FPINDEX));
+	fd = open(p, O_RDONLY | O_CLOEXEC);
+	stunalloc(p);
+	if (fd < 0)
+		return;
+	text = ckmalloc(sb->st_size + 1);
+	for (end = text; end < text + sb->st_size; end += n)
+		if ((n = read(fd, end, text + sb->st_size - end)) <= 0)
+			break;
+	close(fd);
+	*end = '\0';
+
+	count = 0;
+	for (p = text; p < end; p++)
+		count += *p == '\n';
+	for (mask = 15; mask < count * 2; mask = mask * 2 + 1);
+	ix->table = ckmalloc((mask + 1) * sizeof(*ix->table));
+	memset(ix->table, 0, (mask + 1) * sizeof(*ix->table));
+	ix->mask = mask;
+	ix->text = text;
+
+	for (p = text; p < end; p = q + 1) {
+		if (!(q = strchr(p, '\n')))
+			q = end;
+		*q = '\0';
+		if (*p == '#')
+			continue;
+		for (i = 0; i < 10; i++) {
+			f[i] = p;
+			p = strchrnul(p, ' ');
+			if (*p)
+				*p++ = '\0';
+			if (i >= 2 && !is_number(f[i]))
+				break;
+		}
+		if (i < 10 || !*f[0] || !*f[1] || *p)
+			continue;
+		for (i = fphash(f[0]) & mask; ix->table[i].name;
+		     i = (i + 1) & mask);
+		ep = &ix->table[i];
+		ep->name = f[0];
+		ep->file = f[1];
+		ep->off = strtoimax(f[2], NULL, 10);
+		ep->len = strtoumax(f[3], NULL, 10);
+		ep->line = atoi(f[4]);
+		ep->dev = strtoumax(f[5], NULL, 10);
+		ep->ino = strtoumax(f[6], NULL, 10);
+		ep->size = strtoimax(f[7], NULL, 10);
+		ep->sec = strtoimax(f[8], NULL, 10);
+		ep->nsec = atol(f[9]);
+	}
+}
+
+
+static struct fpentry *
+findentry(struct fpindex *ix, const char *name)
+{
+	struct fpentry *ep;
+	unsigned h;
+
+	if (!ix->table)
+		return NULL;
+	for (h = fphash(name) & ix->mask; (ep = &ix->table[h])->name;
+	     h = (h + 1) & ix->mask)
+		if (equal(ep->name, name))
+			return ep;
+	return NULL;
+}
+
+
+/*
+ * Read the text defining a function and run it.  Returns 0 without
+ * running anything if the file has changed since it was indexed or the
+ * text does more than define the function.
+ */
+
+static int
+loadentry(struct fpindex *ix, struct fpentry *ep)
+{
+	struct stackmark smark;
+	struct stat sb;
+	union node *n;
+	char *file, *text;
+	ssize_t len;
+	size_t got;
+	int fd;
+
+	setstackmark(&smark);
+	file = stalloc(strlen(ix->path) + strlen(ep->file) + 1);
+	stpcpy(stpcpy(file, ix->path), ep->file);
+	text = stalloc(ep->len + 1);
+
+	INTOFF;
+	if ((fd = open(file, O_RDONLY | O_CLOEXEC)) < 0)
+		goto stale;
+	if (fstat(fd, &sb) < 0 || sb.st_dev != ep->dev ||
+	    sb.st_ino != ep->ino || sb.st_size != ep->size ||
+#ifdef HAVE_ST_MTIM
+	    sb.st_mtim.tv_nsec != ep->nsec ||
+#endif
+	    sb.st_mtime != ep->sec)
+		goto close;
+	for (got = 0; got < ep->len; got += len) {
+		len = pread(fd, text + got, ep->len - got, ep->off + got);
+		if (len <= 0)
+			goto close;
+	}
+	close(fd);
+	INTON;
+	text[ep->len] = '\0';
+
+	setinputmem(text, ep->len);
+	parsefile->p.flags |= PF_LINENO;
+	plinno = ep->line;
+	n = parsecmd(0);
+	if (n == NEOF || !defunsonly(n, ep->name) ||
+	    parsecmd(0) != NEOF)
+		n = NULL;
+	popfile();
+	if (n)
+		evaltree(n, 0);
+	popstackmark(&smark);
+	return n != NULL;
+
+close:
+	close(fd);
+stale:
+	INTON;
+	popstackmark(&smark);
+	return 0;
+}
+
+
+/*
+ * Return whether a command does nothing but define functions, one of them
+ * name unless that is NULL.
+ */
+
+static int
+defunsonly(union node *n, const char *name)
+{
+	union node *fn;
+	int found = !name;
+
+	if (!n)
+		return 0;
+	for (; n; n = n->type == NSEMI ? n->nbinary.ch1 : NULL) {
+		fn = n->type == NSEMI ? n->nbinary.ch2 : n;
+		if (fn->type != NDEFUN)
+			return 0;
+		if (name && equal(fn->ndefun.text, name))
+			found = 1;
+	}
+	return found;
+}
+
+
+static int
+cmpstr(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+
+/*
+ * The fpindex builtin: write the index of the functions defined in the
+ * given files of a directory, or in all the files in it whose names do
+ * not start with a dot.
+ */
+
+int
+fpindexcmd(int argc, char **argv)
+{
+	jmp_buf *volatile savehandler;
+	jmp_buf jmploc;
+	struct output out;
+	struct dirent *dp;
+	struct stat sb;
+	char **files;
+	char *dir, *p;
+	char *volatile tmp;
+	int nfiles;
+	DIR *dirp;
+	int i;
+
+	nextopt(nullstr);
+	if (!(dir = *argptr++))
+		sh_error("usage: fpindex directory [file ...]");
+
+	for (nfiles = 0; argptr[nfiles]; nfiles++);
+	files = argptr;
+	if (!nfiles) {
+		INTOFF;
+		if (!(dirp = opendir(dir))) {
+			INTON;
+			sh_error("%s: %s", dir, errnomsg());
+		}
+		files = NULL;
+		while ((dp = readdir(dirp))) {
+			if (dp->d_name[0] == '.')
+				continue;
+			p = stalloc(strlen(dir) + strlen(dp->d_name) + 2);
+			stpcpy(stpcpy(stpcpy(p, dir), "/"), dp->d_name);
+			if (stat(p, &sb) < 0 || !S_ISREG(sb.st_mode))
+				continue;
+			if (!(nfiles & 63)) {
+				char **nf = stalloc((nfiles + 64) *
+						    sizeof(*files));
+
+				if (nfiles)
+					memcpy(nf, files,
+					       nfiles * sizeof(*files));
+				files = nf;
+			}
+			files[nfiles++] = sstrdup(dp->d_name);
+		}
+		closedir(dirp);
+		INTON;
+		qsort(files, nfiles, sizeof(*files), cmpstr);
+	}
+
+	p = stalloc(strlen(dir) + sizeof("/" FPINDEX));
+	stpcpy(stpcpy(p, dir), "/" FPINDEX);
+	tmp = stalloc(strlen(p) + sizeof(".tmp"));
+	stpcpy(stpcpy(tmp, p), ".tmp");
+	INTOFF;
+	out.fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	INTON;
+	if (out.fd < 0)
+		sh_error("%s: %s", tmp, errnomsg());
+	out.nextc = out.end = NULL;
+	out.error = 0;
+
+	/* A file that cannot be parsed leaves the old index in place. */
+	savehandler = handler;
+	if (setjmp(jmploc)) {
+		close(out.fd);
+		unlink(tmp);
+		handler = savehandler;
+		longjmp(*handler, 1);
+	}
+	handler = &jmploc;
+	outstr("# name file offset length line dev ino size sec nsec\n",
+	       &out);
+	for (i = 0; i < nfiles; i++)
+		indexfile(&out, dir, files[i]);
+	flushall();
+	if (out.error)
+		errno = out.error;
+	if (out.error || rename(tmp, p) < 0)
+		sh_error("%s: %s", p, errnomsg());
+	handler = savehandler;
+	close(out.fd);
+	pathgen++;
+	return 0;
+}
+
+
+/*
+ * Parse a file and write an index line for each function it defines.
+ * Definitions sharing a line share its text; functions defined on a line
+ * with other commands are left out.
+ */
+
+static void
+indexfile(struct output *out, const char *dir, const char *file)
+{
+	union node *n, *np, *fn;
+	struct stat sb;
+	long nsec;
+	const char *start;
+	char *name, *text;
+	ssize_t len;
+	off_t got;
+	int line;
+	int fd;
+
+	if (strpbrk(file, " \n")) {
+		sh_warnx("%s: file name cannot be indexed", file);
+		return;
+	}
+	name = stalloc(strlen(dir) + strlen(file) + 2);
+	stpcpy(stpcpy(stpcpy(name, dir), "/"), file);
+	INTOFF;
+	if ((fd = open(name, O_RDONLY | O_CLOEXEC)) < 0 ||
+	    fstat(fd, &sb) < 0) {
+		INTON;
+		sh_error("%s: %s", name, errnomsg());
+	}
+	text = stalloc(sb.st_size + 1);
+	for (got = 0; got < sb.st_size; got += len)
+		if ((len = read(fd, text + got, sb.st_size - got)) <= 0)
+			break;
+	close(fd);
+	INTON;
+	text[got] = '\0';
+#ifdef HAVE_ST_MTIM
+	nsec = sb.st_mtim.tv_nsec;
+#else
+	nsec = 0;
+#endif
+
+	setinputmem(text, got);
+	parsefile->p.flags |= PF_LINENO;
+	plinno = 1;
+	for (;;) {
+		start = parsefile->p.nextc;
+		line = plinno;
+		if ((n = parsecmd(0)) == NEOF)
+			break;
+		if (parsefile->strpush || parsefile->p.unget)
+			sh_error("%s: %d: cannot index aliases", name, line);
+		if (!defunsonly(n, NULL))
+			continue;
+		for (np = n; np; np = np->type == NSEMI ?
+					np->nbinary.ch1 : NULL) {
+			fn = np->type == NSEMI ? np->nbinary.ch2 : np;
+			outfmt(out, "%s %s %" PRIdMAX " %" PRIdMAX " %d %" PRIuMAX
+				    " %" PRIuMAX " %" PRIdMAX " %" PRIdMAX " %ld\n",
+			       fn->ndefun.text, file, (intmax_t)(start - text),
+			       (intmax_t)(parsefile->p.nextc - start), line,
+			       (uintmax_t)sb.st_dev, (uintmax_t)sb.st_ino,
+			       (intmax_t)sb.st_size, (intmax_t)sb.st_mtime, nsec);
+		}
+	}
+	popfile();
+}
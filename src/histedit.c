@@ -39,9 +39,14 @@
 #ifdef HAVE_PATHS_H
 #include <paths.h>
 #endif
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #ifdef HAVE_SYS_IOCTL_H
 #include <sys/ioctl.h>
 #endif
@@ -424,34 +429,384 @@ beep:
 }
 #endif
 
-static int
-readwrite_histfile(int cmd)
+/*
+ * The history file is a log that every interactive shell appends the
+ * commands it reads to, one entry per line, in the format libedit's
+ * H_SAVE writes: a "_HiStOrY_V2_" header line followed by entries in
+ * which newlines and backslashes are escaped.  Shells append with a
+ * single write under a shared lock, so concurrent shells interleave
+ * their entries instead of overwriting each other's.  When the file has
+ * grown to twice HISTSIZE entries it is compacted in place under an
+ * exclusive lock.
+ *
+ * At startup the file is mapped and only its last HISTSIZE entries are
+ * decoded and entered into the history.  Their text is kept so that the
+ * patterns of fc can be looked up in an index sorted by text, which is
+ * built the first time it is needed.
+ */
+
+#define HISTHEADER	"_HiStOrY_V2_\n"
+
+struct histent {
+	const char *text;
+	int num;		/* event number */
+};
+
+static char *histtext;		/* decoded text of the loaded entries */
+static size_t histtextsize;
+static struct histent *histindex;
+static int histnent;		/* number of loaded entries */
+static int histsorted;		/* set once histindex is sorted */
+static int histlast;		/* event number of the last loaded entry */
+static int histsaved;		/* event number of the last entry written */
+static int histfilelen;		/* rough count of entries in the file */
+
+static const char *
+histfilename(void)
 {
 	const char *histfile;
-	HistEvent he;
 
 	if (pflag || !hist)
-		return 0;
+		return NULL;
 	histfile = lookupvar("HISTFILE");
 	if (!histfile)
 		histfile = expandstr("${HOME-}/.sh_history", 0);
 	else if (!*histfile)
-		return 0;
-	history(hist, &he, cmd, histfile);
-	return 1;
+		return NULL;
+	return histfile;
+}
+
+static int
+histsizenum(void)
+{
+	const char *hs = histsizeval();
+	int histsize;
+
+	if (hs == NULL || *hs == '\0' || (histsize = atoi(hs)) < 0)
+		histsize = 128;
+	return histsize;
+}
+
+/*
+ * Decode an entry as written by strvis(3), which libedit uses.
+ */
+static char *
+histunvis(char *d, const char *s, const char *end)
+{
+	int c, i;
+
+	while (s < end) {
+		if ((c = *s++) != '\\' || s == end) {
+			*d++ = c;
+			continue;
+		}
+		switch (c = *s++) {
+		case 'n':
+			c = '\n';
+			break;
+		case 't':
+			c = '\t';
+			break;
+		case 's':
+			c = ' ';
+			break;
+		case 'E':
+			c = 033;
+			break;
+		case '0': case '1': case '2': case '3':
+		case '4': case '5': case '6': case '7':
+			c -= '0';
+			for (i = 0; i < 2 && s < end && *s >= '0' && *s <= '7';
+			     i++)
+				c = c * 8 + *s++ - '0';
+			break;
+		case 'M':
+			if (end - s < 2)
+				break;
+			c = *s++ == '^' ? (*s == '?' ? 0177 : *s & 037) : *s;
+			s++;
+			c |= 0200;
+			break;
+		case '^':
+			if (s == end)
+				break;
+			c = *s == '?' ? 0177 : *s & 037;
+			s++;
+			break;
+		case '$':
+			continue;
+		}
+		*d++ = c;
+	}
+	*d++ = '\0';
+	return d;
 }
 
 void
 read_histfile(void)
 {
-	if (readwrite_histfile(H_LOAD))
-		sethistsize(histsizeval());
+	const char *histfile;
+	struct stat st;
+	HistEvent he;
+	char *map, *p, *end, *q;
+	char **lines;
+	int nlines;
+	int first;
+	int fd;
+	int i;
+
+	if (!(histfile = histfilename()))
+		return;
+	sethistsize(histsizeval());
+	INTOFF;
+	fd = open(histfile, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		goto out;
+	flock(fd, LOCK_SH);
+	if (fstat(fd, &st) < 0 || st.st_size == 0 ||
+	    (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) ==
+	    MAP_FAILED) {
+		close(fd);
+		goto out;
+	}
+	close(fd);
+
+	nlines = 0;
+	lines = NULL;
+	end = map + st.st_size;
+	for (p = map; p < end; p = q + 1) {
+		if (!(q = memchr(p, '\n', end - p)))
+			q = end;
+		if (q - p == sizeof(HISTHEADER) - 2 &&
+		    !memcmp(p, HISTHEADER, q - p))
+			continue;
+		if (!(nlines & 1023))
+			lines = ckrealloc(lines,
+					  (nlines + 1024) * sizeof(*lines));
+		lines[nlines++] = p;
+	}
+	histfilelen = nlines;
+
+	first = nlines - histsizenum();
+	if (first < 0)
+		first = 0;
+	histnent = nlines - first;
+	histtextsize = end - (histnent ? lines[first] : end) + 1;
+	histtext = ckmalloc(histtextsize);
+	histindex = ckmalloc((histnent + 1) * sizeof(*histindex));
+	for (p = histtext, i = 0; i < histnent; i++) {
+		char *e;
+
+		q = lines[first + i];
+		if (!(e = memchr(q, '\n', end - q)))
+			e = end;
+		histindex[i].text = p;
+		p = histunvis(p, q, e);
+		history(hist, &he, H_ENTER, histindex[i].text);
+		histindex[i].num = he.num;
+	}
+	if (histnent)
+		histlast = histsaved = histindex[histnent - 1].num;
+	ckfree(lines);
+	munmap(map, st.st_size);
+out:
+	INTON;
+}
+
+/*
+ * Append the entries made since the last call to the history file.
+ */
+void
+histflush(void)
+{
+	const char *histfile;
+	struct stat st, st2;
+	struct stackmark smark;
+	HistEvent he;
+	const char **ents;
+	const char *s;
+	char *p;
+	int n, i;
+	int fd;
+
+	if (!(histfile = histfilename()) ||
+	    history(hist, &he, H_FIRST) == -1 || he.num == histsaved)
+		return;
+
+	setstackmark(&smark);
+	n = 0;
+	do
+		n++;
+	while (history(hist, &he, H_NEXT) != -1 && he.num > histsaved);
+	ents = stalloc(n * sizeof(*ents));
+	history(hist, &he, H_FIRST);
+	histsaved = he.num;
+	for (i = n; --i >= 0; history(hist, &he, H_NEXT))
+		ents[i] = he.str;
+
+	STARTSTACKSTR(p);
+	for (i = 0; i < n; i++) {
+		for (s = ents[i]; *s; s++) {
+			if (*s == '\\')
+				p = stputs("\\\\", p);
+			else if (*s == '\n')
+				p = stputs("\\012", p);
+			else
+				STPUTC(*s, p);
+		}
+		STPUTC('\n', p);
+	}
+	histfilelen += n;
+
+	INTOFF;
+	fd = open(histfile, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0)
+		goto out;
+	/*
+	 * Compaction works in place, but the file may still have been
+	 * replaced by some other program while we waited for the lock.
+	 */
+	flock(fd, LOCK_SH);
+	if (fstat(fd, &st) == 0 && stat(histfile, &st2) == 0 &&
+	    st.st_dev == st2.st_dev && st.st_ino == st2.st_ino) {
+		if (st.st_size == 0)
+			xwrite(fd, HISTHEADER, sizeof(HISTHEADER) - 1);
+		xwrite(fd, stackblock(), p - (char *)stackblock());
+	}
+	close(fd);
+out:
+	INTON;
+	popstackmark(&smark);
+}
+
+/*
+ * Cut the history file down to its last HISTSIZE entries.
+ */
+static void
+compact_histfile(const char *histfile)
+{
+	struct stat st;
+	char *map, *p;
+	size_t len;
+	int histsize, n;
+	int fd;
+
+	histsize = histsizenum();
+	INTOFF;
+	fd = open(histfile, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		goto out;
+	flock(fd, LOCK_EX);
+	if (fstat(fd, &st) < 0 || st.st_size == 0 ||
+	    (map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, 0)) == MAP_FAILED)
+		goto unlock;
+
+	/* Find the start of the last histsize entries. */
+	len = sizeof(HISTHEADER) - 1;
+	p = map + st.st_size;
+	if (p[-1] == '\n')
+		p--;
+	for (n = 0; p > map; p--)
+		if (p[-1] == '\n' && ++n == histsize)
+			break;
+	if (p > map + len) {
+		memcpy(map, HISTHEADER, len);
+		memmove(map + len, p, map + st.st_size - p);
+		len += map + st.st_size - p;
+		msync(map, len, MS_SYNC);
+		ftruncate(fd, len);
+	}
+	munmap(map, st.st_size);
+	histfilelen = n;
+unlock:
+	close(fd);
+out:
+	INTON;
 }
 
 void
 write_histfile(void)
 {
-	readwrite_histfile(H_SAVE);
+	const char *histfile;
+
+	histflush();
+	if ((histfile = histfilename()) && histfilelen > 2 * histsizenum())
+		compact_histfile(histfile);
+}
+
+static int
+histentcmp(const void *a, const void *b)
+{
+	const struct histent *ha = a, *hb = b;
+	int c = strcmp(ha->text, hb->text);
+
+	return c ? c : ha->num - hb->num;
+}
+
+/*
+ * Find the latest event starting with prefix.  The entries of this
+ * session are searched first; the ones loaded from the history file are
+ * looked up in the index.  Returns -1 if there is none.
+ */
+static int
+histfind(const char *prefix)
+{
+	size_t len = strlen(prefix);
+	HistEvent he;
+	int lo, hi, mid;
+	int num;
+	int r;
+
+	for (r = history(hist, &he, H_FIRST); r != -1 && he.num > histlast;
+	     r = history(hist, &he, H_NEXT))
+		if (!strncmp(he.str, prefix, len))
+			return he.num;
+
+	if (!histsorted) {
+		qsort(histindex, histnent, sizeof(*histindex), histentcmp);
+		histsorted = 1;
+	}
+	lo = 0;
+	hi = histnent;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (strncmp(histindex[mid].text, prefix, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	num = -1;
+	for (; lo < histnent && !strncmp(histindex[lo].text, prefix, len);
+	     lo++)
+		if (histindex[lo].num > num)
+			num = histindex[lo].num;
+	/* It may have been dropped to keep to HISTSIZE. */
+	if (num >= 0 && (history(hist, &he, H_FIRST) == -1 ||
+			 history(hist, &he, H_NEXT_EVENT, num) == -1))
+		num = -1;
+	return num;
+}
+
+/*
+ * Add up the history entries and the memory their text takes for
+ * meminfo, including the text kept for the index.
+ */
+void
+histmemuse(struct memuse *mu)
+{
+	HistEvent he;
+	int r;
+
+	if (hist == NULL)
+		return;
+	for (r = history(hist, &he, H_FIRST); r != -1;
+	     r = history(hist, &he, H_NEXT)) {
+		mu->count++;
+		mu->bytes += strlen(he.str) + 1;
+	}
+	if (histindex)
+		mu->bytes += histtextsize + (histnent + 1) * sizeof(*histindex);
 }
 
 void
@@ -770,9 +1125,9 @@ str_to_event(const char *str, int last)
 		/*
 		 * pattern
 		 */
-		retval = history(hist, &he, H_PREV_STR, str);
-		if (retval == -1)
+		if ((i = histfind(str)) < 0)
 			sh_error("history pattern not found: %s", str);
+		return i;
 	}
 	return (he.num);
 }
@@ -51,6 +51,8 @@
 #include "shell.h"
 #include <termios.h>
 #include "eval.h"
+#include "exec.h"
+#include "forkserver.h"
 #include "redir.h"
 #include "show.h"
 #include "main.h"
@@ -67,6 +69,7 @@
 #include "init.h"
 #include "mystring.h"
 #include "system.h"
+#include "var.h"
 
 /* mode flags for set_curjob */
 #define CUR_DELETE 2
@@ -90,6 +93,9 @@ static int ttyfd = -1;
 /* saved tty process group */
 MKINIT pid_t ttypgrp;
 
+/* maximum number of concurrently running background jobs, 0 if unlimited */
+static unsigned jobmax;
+
 /* current job */
 static struct job *curjob;
 /* whether the current jobs were inherited from a parent shell */
@@ -100,19 +106,22 @@ static int jobno(const struct job *);
 static int sprint_status(char *, int);
 static void freejob(struct job *);
 static void freejobs(void);
+static int waitany(char **, const char *);
+static struct job *getwaitjob(const char *);
 static struct job *getjob(const char *, int);
 static struct job *growjobtab(void);
 static void forkchild(struct job *, union node *, int);
 static void forkparent(struct job *, union node *, int, pid_t);
 static int dowait(int, struct job *);
-static int waitproc(int, int *);
-static char *commandtext(union node *);
+static int waitproc(int, int *, struct rusage *);
 static void cmdtxt(union node *);
 static void cmdlist(union node *, int);
 static void cmdputs(const char *);
+static void showusage(struct procstat *, struct output *);
 static void showpipe(struct job *, struct output *);
 static int getstatus(struct job *);
 
+static void waitjobmax(struct job *);
 static int restartjob(struct job *, int);
 static void xtcsetpgrp(pid_t);
 
@@ -513,6 +522,8 @@ start:
 			showpipe(jp, out);
 			break;
 		}
+		if (ps->status != -1 && !WIFSTOPPED(ps->status))
+			showusage(ps, out);
 		if (++ps == psend) {
 			outcslow('\n', out);
 			break;
@@ -606,11 +617,21 @@ waitcmd(int argc, char **argv)
 	struct job *job;
 	int retval;
 	struct job *jp;
+	const char *pidvar = NULL;
+	int any = 0;
+	int c;
 
-	nextopt(nullstr);
+	while ((c = nextopt("np:")) != '\0') {
+		if (c == 'n')
+			any = 1;
+		else
+			pidvar = optionarg;
+	}
 	retval = 0;
 
 	argv = argptr;
+	if (any)
+		return waitany(argv, pidvar);
 	if (!*argv) {
 		/* wait for all jobs */
 		for (;;) {
@@ -632,28 +653,17 @@ waitcmd(int argc, char **argv)
 
 	retval = 127;
 	do {
-		if (**argv != '%') {
-			pid_t pid = number(*argv);
-			job = curjob;
-			goto start;
-			do {
-				if (job->ps[job->nprocs - 1].pid == pid)
-					break;
-				job = job->prev_job;
-start:
-				if (!job)
-					goto repeat;
-			} while (1);
-		} else
-			job = getjob(*argv, 0);
+		job = getwaitjob(*argv);
+		if (!job)
+			continue;
 		/* loop until process terminated or stopped */
 		while (job->state == JOBRUNNING)
 			if (dowait(DOWAIT_WAITCMD, 0) <= 0)
 				goto sigout;
 		job->waited = 1;
 		retval = getstatus(job);
-repeat:
-		;
+		if (pidvar)
+			setvarint(pidvar, job->ps[job->nprocs - 1].pid, 0);
 	} while (*++argv);
 
 out:
@@ -666,6 +676,84 @@ sigout:
 
 
 
+/*
+ * Wait for any one of the jobs named in argv, or for any job if argv is
+ * empty, to complete.  Jobs that completed earlier but were not waited for
+ * yet are reported first.  Returns 127 if there is nothing to wait for.
+ */
+
+static int
+waitany(char **argv, const char *pidvar)
+{
+	struct job **jobs;
+	struct job **jpp;
+	struct job *jp;
+	char **ap;
+	size_t n;
+	int running;
+
+	n = 0;
+	for (jp = curjob; jp; jp = jp->prev_job)
+		n++;
+	for (ap = argv; *ap; ap++)
+		n++;
+	jpp = jobs = stalloc((n + 1) * sizeof(*jobs));
+	if (*argv) {
+		do {
+			if ((jp = getwaitjob(*argv)))
+				*jpp++ = jp;
+		} while (*++argv);
+	} else {
+		for (jp = curjob; jp; jp = jp->prev_job)
+			*jpp++ = jp;
+	}
+	*jpp = NULL;
+
+	for (;;) {
+		running = 0;
+		for (jpp = jobs; (jp = *jpp); jpp++) {
+			if (jp->state == JOBDONE && !jp->waited)
+				goto gotjob;
+			if (jp->state == JOBRUNNING)
+				running = 1;
+		}
+		if (!running)
+			return 127;
+		if (dowait(DOWAIT_WAITCMD, 0) <= 0)
+			return 128 + pending_sig;
+	}
+
+gotjob:
+	jp->waited = 1;
+	if (pidvar)
+		setvarint(pidvar, jp->ps[jp->nprocs - 1].pid, 0);
+	return getstatus(jp);
+}
+
+
+
+/*
+ * Convert an argument to wait to a job structure.  Process IDs that do not
+ * belong to a known job yield NULL.
+ */
+
+static struct job *
+getwaitjob(const char *name)
+{
+	struct job *jp;
+	pid_t pid;
+
+	if (*name == '%')
+		return getjob(name, 0);
+	pid = number(name);
+	for (jp = curjob; jp; jp = jp->prev_job)
+		if (jp->ps[jp->nprocs - 1].pid == pid)
+			break;
+	return jp;
+}
+
+
+
 /*
  * Convert a job name to a job structure.
  */
@@ -834,6 +922,31 @@ growjobtab(void)
 }
 
 
+/*
+ * Add up the jobs in use and the memory the job table takes for meminfo.
+ */
+
+void
+jobmemuse(struct memuse *mu)
+{
+	struct procstat *ps;
+	struct job *jp;
+	int i;
+
+	mu->bytes += njobs * sizeof(*jp);
+	for (jp = jobtab; jp < jobtab + njobs; jp++) {
+		if (!jp->used)
+			continue;
+		mu->count++;
+		if (jp->ps != &jp->ps0)
+			mu->bytes += jp->nprocs * sizeof(*ps);
+		for (i = jp->nprocs, ps = jp->ps ; --i >= 0 ; ps++)
+			if (ps->cmd != nullstr)
+				mu->bytes += strlen(ps->cmd) + 1;
+	}
+}
+
+
 /*
  * Fork off a subshell.  If we are doing job control, give the subshell its
  * own process group.  Jp is a job structure that the job is to be added to.
@@ -911,6 +1024,7 @@ forkparent(struct job *jp, union node *n, int mode, pid_t pid)
 	}
 	if (jp) {
 		struct procstat *ps = &jp->ps[jp->nprocs++];
+		memset(ps, 0, sizeof(*ps));
 		ps->pid = pid;
 		ps->status = -1;
 		ps->cmd = nullstr;
@@ -923,11 +1037,22 @@ int
 forkshell(struct job *jp, union node *n, int mode)
 {
 	int pid;
+	int masked;
 
 	TRACE(("forkshell(%%%d, %p, %d) called\n", jobno(jp), n, mode));
 	if (mode == FORK_FG && jp->jobctl)
 		gettty(0);
-	sigprocmask(SIG_SETMASK, &sigset_full, 0);
+	if (mode == FORK_BG && jobmax && !jp->nprocs)
+		waitjobmax(jp);
+	/*
+	 * Signals only need to be blocked if the child could run one of our
+	 * handlers before reset() has replaced it.  The SIGCHLD handler
+	 * merely sets a flag, so is harmless.
+	 */
+	masked = catchcnt;
+	if (masked)
+		sigprocmask(SIG_SETMASK, &sigset_full, 0);
+	etraceflush();
 	pid = fork();
 	if (pid < 0) {
 		TRACE(("Fork failed, errno=%d", errno));
@@ -937,12 +1062,53 @@ forkshell(struct job *jp, union node *n, int mode)
 	}
 	if (pid == 0)
 		forkchild(jp, n, mode);
-	else
+	else {
 		forkparent(jp, n, mode, pid);
-	sigprocmask(SIG_SETMASK, &sigset_empty, 0);
+		if (etracefd >= 0) {
+			etracebegin("fork");
+			etraceint("child", pid);
+			etraceint("job", jp ? jobno(jp) : 0);
+			etraceint("mode", mode);
+			etraceend();
+		}
+	}
+	if (masked)
+		sigprocmask(SIG_SETMASK, &sigset_empty, 0);
 	return pid;
 }
 
+/*
+ * Block until fewer than JOBMAX background jobs other than jp are running.
+ * Only the first process of a job is held back so that pipelines are never
+ * split.  An interrupt lets the fork go ahead; it is acted upon afterwards.
+ *
+ * Called with interrupts off.
+ */
+
+static void
+waitjobmax(struct job *jp)
+{
+	struct job *jq;
+	unsigned running;
+
+	for (;;) {
+		running = 0;
+		for (jq = curjob; jq; jq = jq->prev_job)
+			if (jq != jp && jq->state == JOBRUNNING)
+				running++;
+		if (running < jobmax)
+			break;
+		if (dowait(DOWAIT_WAITCMD, NULL) <= 0)
+			break;
+	}
+}
+
+void
+changejobmax(const char *val)
+{
+	jobmax = is_number(val) ? atoi(val) : 0;
+}
+
 /*
  * Wait for job to finish.
  *
@@ -1002,6 +1168,20 @@ waitforjob(struct job *jp)
 
 
 
+/*
+ * Forget a job whose processes are left running, such as a command
+ * substitution that ran out of time.  They are reaped by dowait like any
+ * other child that belongs to no job.
+ */
+
+void
+detachjob(struct job *jp)
+{
+	freejob(jp);
+}
+
+
+
 /*
  * Wait for a process to terminate.
  */
@@ -1011,16 +1191,18 @@ dowait(int block, struct job *job)
 {
 	int pid;
 	int status;
+	struct rusage ru;
 	struct job *jp;
 	struct job *thisjob = NULL;
 	int state;
 
 	INTOFF;
 	TRACE(("dowait(%d) called\n", block));
-	pid = waitproc(block, &status);
+	pid = waitproc(block, &status, &ru);
 	TRACE(("wait returns pid %d, status=%d\n", pid, status));
 	if (pid <= 0)
 		goto out;
+	pathgen++;
 
 	for (jp = curjob; jp; jp = jp->prev_job) {
 		struct procstat *sp;
@@ -1034,6 +1216,13 @@ dowait(int block, struct job *job)
 			if (sp->pid == pid) {
 				TRACE(("Job %d: changing status of proc %d from 0x%x to 0x%x\n", jobno(jp), pid, sp->status, status));
 				sp->status = status;
+				if (!WIFSTOPPED(status)) {
+					sp->utime = ru.ru_utime;
+					sp->stime = ru.ru_stime;
+					sp->maxrss = ru.ru_maxrss;
+					sp->nvcsw = ru.ru_nvcsw;
+					sp->nivcsw = ru.ru_nivcsw;
+				}
 				thisjob = jp;
 			}
 			if (sp->status == -1)
@@ -1048,6 +1237,7 @@ dowait(int block, struct job *job)
 		if (thisjob)
 			goto gotjob;
 	}
+	fsdone(pid, status);
 	goto out;
 
 gotjob:
@@ -1060,6 +1250,15 @@ gotjob:
 			if (state == JOBSTOPPED) {
 				set_curjob(thisjob, CUR_STOPPED);
 			}
+			if (etracefd >= 0) {
+				etracebegin("job");
+				etraceint("job", jobno(thisjob));
+				etraceint("child", pid);
+				etraceint("status", status);
+				etracestr("state", state == JOBSTOPPED ?
+						   "stopped" : "done");
+				etraceend();
+			}
 		}
 	}
 
@@ -1074,11 +1273,12 @@ out:
 /*
  * Do a wait system call.  If job control is compiled in, we accept
  * stopped processes.  If block is zero, we return a value of zero
- * rather than blocking.
+ * rather than blocking.  The resource usage of a terminated process is
+ * stored in ru.
  */
 
 static int
-waitproc(int block, int *status)
+waitproc(int block, int *status, struct rusage *ru)
 {
 	int flags = block == DOWAIT_BLOCK ? 0 : WNOHANG;
 	int err;
@@ -1088,7 +1288,7 @@ waitproc(int block, int *status)
 
 	do {
 		gotsigchld = 0;
-		err = wait3(status, flags, NULL);
+		err = wait3(status, flags, ru);
 		if (err || !block)
 			break;
 
@@ -1166,7 +1366,7 @@ RESET {
 
 static char *cmdnextc;
 
-static char *
+char *
 commandtext(union node *n)
 {
 	char *name;
@@ -1185,7 +1385,7 @@ cmdtxt(union node *n)
 	union node *np;
 	struct nodelist *lp;
 	const char *p;
-	char s[2];
+	char s[12];
 
 	if (!n)
 		return;
@@ -1221,6 +1421,10 @@ binop:
 	case NBACKGND:
 		n = n->nredir.n;
 		goto donode;
+	case NTIME:
+		cmdputs(n->ntime.posix ? "time -p " : "time ");
+		n = n->ntime.com;
+		goto donode;
 	case NNOT:
 		cmdputs("!");
 		n = n->nnot.com;
@@ -1318,13 +1522,24 @@ dotail2:
 	case NFROMTO:
 		p = "<>";
 redir:
-		s[0] = n->nfile.fd + '0';
-		s[1] = '\0';
-		cmdputs(s);
+		if (n->nfile.fdvar) {
+			cmdputs("{");
+			cmdputs(n->nfile.fdvar->narg.text);
+			cmdputs("}");
+		} else {
+			fmtstr(s, sizeof(s), "%d", n->nfile.fd);
+			cmdputs(s);
+		}
 		cmdputs(p);
 		if (n->type == NTOFD || n->type == NFROMFD) {
-			s[0] = n->ndup.dupfd + '0';
-			p = s;
+			if (n->ndup.vname)
+				p = n->ndup.vname->narg.text;
+			else if (n->ndup.dupfd < 0)
+				p = "-";
+			else {
+				fmtstr(s, sizeof(s), "%d", n->ndup.dupfd);
+				p = s;
+			}
 			goto dotail2;
 		} else {
 			n = n->nfile.fname;
@@ -1433,6 +1648,22 @@ dostr:
 }
 
 
+/*
+ * Show the resource usage of a terminated process for jobs -l.
+ */
+
+static void
+showusage(struct procstat *ps, struct output *out)
+{
+	outfmt(
+		out, " (user %ld.%03lds sys %ld.%03lds maxrss %ldk csw %ld/%ld)",
+		(long)ps->utime.tv_sec, (long)ps->utime.tv_usec / 1000,
+		(long)ps->stime.tv_sec, (long)ps->stime.tv_usec / 1000,
+		ps->maxrss, ps->nvcsw, ps->nivcsw
+	);
+}
+
+
 static void
 showpipe(struct job *jp, struct output *out)
 {
@@ -41,6 +41,7 @@
 
 #include <inttypes.h>
 #include <sys/types.h>
+#include <sys/time.h>
 
 /* Mode argument to forkshell.  Don't change FORK_FG or FORK_BG. */
 #define FORK_FG 0
@@ -64,6 +65,11 @@ struct procstat {
 	pid_t	pid;		/* process id */
  	int	status;		/* last process status from wait() */
 	const char *cmd;	/* text of command being run */
+	struct timeval utime;	/* user time used, once terminated */
+	struct timeval stime;	/* system time used, once terminated */
+	long	maxrss;		/* maximum resident set size in kilobytes */
+	long	nvcsw;		/* voluntary context switches */
+	long	nivcsw;		/* involuntary context switches */
 };
 
 struct job {
@@ -99,10 +105,15 @@ int jobscmd(int, char **);
 struct output;
 void showjobs(struct output *, int);
 int waitcmd(int, char **);
+void changejobmax(const char *);
 struct job *makejob(union node *, int);
 int forkshell(struct job *, union node *, int);
+char *commandtext(union node *);
 int waitforjob(struct job *);
+void detachjob(struct job *);
 int stoppedjobs(void);
 void resetjobs(void);
+struct memuse;
+void jobmemuse(struct memuse *);
 
 #endif
@@ -39,7 +39,18 @@
  */
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#include <sys/vfs.h>
+#endif
+#ifdef HAVE_LINUX_MAGIC_H
+#include <linux/magic.h>
+#endif
 
 #include "shell.h"
 #include "nodes.h"
@@ -54,60 +65,274 @@
 
 #define MAXMBOXES 10
 
-/* times of mailboxes */
-static time_t mailtime[MAXMBOXES];
+struct mailbox {
+	char *path;		/* name of the mailbox */
+	const char *msg;	/* message to print, or NULL */
+	time_t mtime;		/* modification time when last checked */
+	int dirty;		/* set if a change was reported */
+	int poll;		/* set if changes are not reported */
+#ifdef HAVE_SYS_INOTIFY_H
+	int wd;			/* watch on the mailbox */
+	int dwd;		/* watch on its directory */
+#endif
+};
+
+static struct mailbox mailbox[MAXMBOXES];
+static int nmailbox;
+/* copy of MAILPATH or MAIL that the paths point into */
+static char *mailpath;
+/* when mailboxes that are not watched were last checked */
+static time_t lastpoll;
 /* Set if MAIL or MAILPATH is changed. */
-static int changed;
+static int changed = 1;
+
+#ifdef HAVE_SYS_INOTIFY_H
+static int inotifyfd = -1;
 
+#define MAILMASK (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | \
+		  IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF | \
+		  IN_MOVE_SELF | IN_MASK_ADD)
+#define DIRMASK (IN_CREATE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM | \
+		 IN_MASK_ADD)
+#endif
 
 
+#ifdef HAVE_SYS_INOTIFY_H
 /*
- * Print appropriate message(s) if mail has arrived.  If changed is set,
- * then the value of MAIL has changed, so we just update the values.
+ * Open the inotify descriptor when the first mailbox is watched, so that
+ * a shell with no mailboxes has none.
  */
 
-void
-chkmail(void)
+static int
+openmailwatch(void)
 {
-	const char *mpath;
-	const char *mpathopt;
+	int fd;
+
+	inotifyfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotifyfd >= 0 && inotifyfd < 10) {
+		fd = fcntl(inotifyfd, F_DUPFD_CLOEXEC, 10);
+		close(inotifyfd);
+		inotifyfd = fd;
+	}
+	return inotifyfd >= 0;
+}
+
+
+/*
+ * Return whether a file system may be changed by other machines, whose
+ * changes inotify does not report.
+ */
+
+static int
+remotefs(unsigned long type)
+{
+	switch (type) {
+#ifdef NFS_SUPER_MAGIC
+	case NFS_SUPER_MAGIC:
+#endif
+#ifdef SMB_SUPER_MAGIC
+	case SMB_SUPER_MAGIC:
+#endif
+#ifdef CIFS_SUPER_MAGIC
+	case CIFS_SUPER_MAGIC:
+#endif
+#ifdef SMB2_SUPER_MAGIC
+	case SMB2_SUPER_MAGIC:
+#endif
+#ifdef FUSE_SUPER_MAGIC
+	case FUSE_SUPER_MAGIC:
+#endif
+#ifdef AFS_SUPER_MAGIC
+	case AFS_SUPER_MAGIC:
+#endif
+#ifdef CEPH_SUPER_MAGIC
+	case CEPH_SUPER_MAGIC:
+#endif
+		return 1;
+	}
+	return 0;
+}
+
+
+/*
+ * Start watching a mailbox, and the directory it is in so that we hear
+ * when it is created or replaced.  Changes made by other machines to
+ * network file systems are not reported, so those mailboxes are polled.
+ */
+
+static void
+watchmail(struct mailbox *mb)
+{
+	struct statfs sfs;
+	char *p;
+
+	mb->poll = 1;
+	p = strrchr(mb->path, '/');
+	if (!p)
+		return;
+	*p = '\0';
+	if (statfs(*mb->path ? mb->path : "/", &sfs) < 0) {
+		*p = '/';
+		return;
+	}
+	if (remotefs((unsigned long)sfs.f_type) || (inotifyfd < 0 &&
+						      !openmailwatch())) {
+		*p = '/';
+		return;
+	}
+	mb->dwd = inotify_add_watch(inotifyfd, *mb->path ? mb->path : "/",
+				    DIRMASK);
+	*p = '/';
+	if (mb->dwd < 0)
+		return;
+	mb->wd = inotify_add_watch(inotifyfd, mb->path, MAILMASK);
+	mb->poll = 0;
+}
+
+
+/*
+ * Mark the mailboxes that changes were reported for.
+ */
+
+static void
+readmailevents(void)
+{
+	union {
+		struct inotify_event ev;
+		char buf[4096];
+	} u;
+	struct inotify_event *ev;
+	struct mailbox *mb;
+	ssize_t len;
 	char *p;
-	char *q;
-	time_t *mtp;
-	struct stackmark smark;
+
+	while ((len = read(inotifyfd, u.buf, sizeof(u.buf))) > 0) {
+		for (p = u.buf; p < u.buf + len;
+		     p += sizeof(*ev) + ev->len) {
+			ev = (struct inotify_event *)p;
+			for (mb = mailbox; mb < mailbox + nmailbox; mb++) {
+				if (ev->mask & IN_Q_OVERFLOW ||
+				    ev->wd == mb->wd ||
+				    (ev->wd == mb->dwd && ev->len &&
+				     equal(ev->name,
+					   strrchr(mb->path, '/') + 1)))
+					mb->dirty = 1;
+			}
+		}
+	}
+}
+#endif
+
+
+/*
+ * Forget the mailboxes, and find the ones named by MAILPATH or MAIL.
+ */
+
+static void
+setmail(void)
+{
+	const char *mpath;
+	char *mpathopt;
+	struct mailbox *mb;
 	struct stat statb;
+	char *p;
+	int len;
 
-	setstackmark(&smark);
-	mpath = mpathset() ? mpathval() : mailval();
-	for (mtp = mailtime; mtp < mailtime + MAXMBOXES; mtp++) {
-		int len;
+	INTOFF;
+#ifdef HAVE_SYS_INOTIFY_H
+	if (inotifyfd >= 0) {
+		close(inotifyfd);
+		inotifyfd = -1;
+	}
+#endif
+	for (mb = mailbox; mb < mailbox + nmailbox; mb++)
+		ckfree(mb->path);
+	ckfree(mailpath);
+	nmailbox = 0;
 
-		len = padvance(&mpath, &mpathopt, nullstr);
+	mpath = mpathset() ? mpathval() : mailval();
+	mailpath = savestr(mpath);
+	mpath = mailpath;
+	for (mb = mailbox; mb < mailbox + MAXMBOXES; mb++) {
+		len = padvance(&mpath, (const char **)&mpathopt, nullstr);
 		if (len < 0)
 			break;
 		p = stackblock();
 		if (*p == '\0')
 			continue;
-		for (q = p ; *q ; q++);
-#ifdef DEBUG
-		if (q[-1] != '/')
-			abort();
-#endif
-		q[-1] = '\0';			/* delete trailing '/' */
-		if (stat(p, &statb) < 0) {
-			*mtp = 0;
+		p[strlen(p) - 1] = '\0';	/* delete trailing '/' */
+		mb->path = savestr(p);
+		mb->msg = mpathopt;
+		if (mpathopt)
+			*strchrnul(mpathopt, ':') = '\0';
+		mb->mtime = stat(p, &statb) < 0 ? 0 : statb.st_mtime;
+		mb->dirty = 0;
+#ifdef HAVE_SYS_INOTIFY_H
+		mb->wd = mb->dwd = -1;
+		watchmail(mb);
+#else
+		mb->poll = 1;
+#endif
+		nmailbox++;
+	}
+	INTON;
+}
+
+
+/*
+ * Print appropriate message(s) if mail has arrived.  If changed is set,
+ * then the value of MAIL has changed, so we just update the values.
+ * Mailboxes are only looked at when a change to them has been reported,
+ * or if that is not possible, every MAILCHECK seconds.
+ */
+
+void
+chkmail(void)
+{
+	struct mailbox *mb;
+	struct stat statb;
+	const char *val;
+	time_t now;
+	int poll;
+
+	if (changed) {
+		changed = 0;
+		setmail();
+		lastpoll = time(NULL);
+		return;
+	}
+
+#ifdef HAVE_SYS_INOTIFY_H
+	if (inotifyfd >= 0)
+		readmailevents();
+#endif
+	now = time(NULL);
+	val = lookupvar("MAILCHECK");
+	poll = now - lastpoll >= (val && is_number(val) ? atoi(val) : 60);
+	if (poll)
+		lastpoll = now;
+
+	for (mb = mailbox; mb < mailbox + nmailbox; mb++) {
+		if (!mb->dirty && !(mb->poll && poll))
+			continue;
+		mb->dirty = 0;
+#ifdef HAVE_SYS_INOTIFY_H
+		if (!mb->poll)
+			mb->wd = inotify_add_watch(inotifyfd, mb->path,
+						   MAILMASK);
+#endif
+		if (stat(mb->path, &statb) < 0) {
+			mb->mtime = 0;
 			continue;
 		}
-		if (!changed && statb.st_mtime != *mtp) {
+		if (statb.st_mtime != mb->mtime) {
 			outfmt(
 				&errout, snlfmt,
-				mpathopt ? mpathopt : "you have mail"
+				mb->msg ? mb->msg : "you have mail"
 			);
 		}
-		*mtp = statb.st_mtime;
+		mb->mtime = statb.st_mtime;
 	}
-	changed = 0;
-	popstackmark(&smark);
 }
 
 
@@ -66,6 +66,7 @@
 #endif
 #include "exec.h"
 #include "cd.h"
+#include "forkserver.h"
 
 #define PROFILE 0
 
@@ -114,6 +115,8 @@ main(int argc, char **argv)
 #ifdef __GLIBC__
 	gwsh_errno = __errno_location();
 #endif
+	if (argc > 1)
+		forkclient(argc, argv);
 
 #if PROFILE
 	monitor(4, etext, profile_buf, sizeof profile_buf, 50);
@@ -232,6 +235,10 @@ cmdloop(int top)
 			chkmail();
 		}
 		n = parsecmd(inter);
+#ifndef SMALL
+		if (inter)
+			histflush();
+#endif
 		/* showtree(n); DEBUG */
 		if (n == NEOF) {
 			if (!top || !iflag || numeof >= 50)
@@ -251,6 +258,7 @@ cmdloop(int top)
 
 			job_warning = (job_warning == 2) ? 1 : 0;
 			numeof = 0;
+			statgen++;
 			i = evaltree(n, 0);
 			if (n)
 				status = i;
@@ -47,6 +47,8 @@
 #include "mystring.h"
 #include "system.h"
 
+struct memstats memstats;
+
 /*
  * Like malloc, but returns an error when out of space.
  */
@@ -56,6 +58,7 @@ ckmalloc(size_t nbytes)
 {
 	void *p;
 
+	memstats.mallocs++;
 	p = malloc(nbytes);
 	if (p == NULL)
 		sh_error("Out of space");
@@ -70,6 +73,7 @@ ckmalloc(size_t nbytes)
 void *
 ckrealloc(void *p, size_t nbytes)
 {
+	memstats.reallocs++;
 	p = realloc(p, nbytes);
 	if (p == NULL)
 		sh_error("Out of space");
@@ -84,13 +88,43 @@ ckrealloc(void *p, size_t nbytes)
 char *
 savestr(const char *s)
 {
-	char *p = strdup(s);
+	char *p;
+
+	memstats.mallocs++;
+	p = strdup(s);
 	if (!p)
 		sh_error("Out of space");
 	return p;
 }
 
 
+/*
+ * Allocate a record from a pool.  Records are never given back to malloc;
+ * the pools hold the shell's variables and the frames of function calls,
+ * whose numbers stay small.
+ */
+
+/* number of records carved from each block */
+#define POOLCHUNK 32
+
+void *
+poolalloc(struct pool *pool)
+{
+	char *p, *q;
+	int i;
+
+	if ((p = pool->free) == NULL) {
+		p = ckmalloc(POOLCHUNK * pool->size);
+		memstats.poolbytes += POOLCHUNK * pool->size;
+		for (i = POOLCHUNK - 1, q = p; --i >= 0; q += pool->size)
+			*(void **)q = q + pool->size;
+		*(void **)q = NULL;
+	}
+	pool->free = *(void **)p;
+	return p;
+}
+
+
 /*
  * Parse trees for commands are allocated in lifo order, so we use a stack
  * to make this more efficient, and also to avoid all sorts of exception
@@ -105,6 +139,7 @@ savestr(const char *s)
 
 struct stack_block {
 	struct stack_block *prev;
+	size_t size;		/* bytes allocated for the block */
 	char space[MINSIZE];
 };
 
@@ -114,6 +149,15 @@ char *stacknxt = stackbase.space;
 size_t stacknleft = MINSIZE;
 char *sstrend = stackbase.space + MINSIZE;
 
+static void
+stackgrew(size_t bytes, int blocks)
+{
+	memstats.stackblocks += blocks;
+	memstats.stackbytes += bytes;
+	if (memstats.stackbytes > memstats.stackpeak)
+		memstats.stackpeak = memstats.stackbytes;
+}
+
 void *
 stalloc(size_t nbytes)
 {
@@ -135,6 +179,8 @@ stalloc(size_t nbytes)
 		INTOFF;
 		sp = ckmalloc(len);
 		sp->prev = stackp;
+		sp->size = len;
+		stackgrew(len, 1);
 		stacknxt = (char *)sp + offsetof(struct stack_block, space);
 		stacknleft = blocksize;
 		sstrend = stacknxt + blocksize;
@@ -188,6 +234,8 @@ popstackmark(struct stackmark *mark)
 	while (stackp != mark->stackp) {
 		sp = stackp;
 		stackp = sp->prev;
+		memstats.stackblocks--;
+		memstats.stackbytes -= sp->size;
 		ckfree(sp);
 	}
 	stacknxt = mark->stacknxt;
@@ -227,8 +275,10 @@ growstackblock(void)
 		sp = stackp;
 		prevstackp = sp->prev;
 		grosslen = newlen + sizeof(struct stack_block) - MINSIZE;
+		stackgrew(grosslen - sp->size, 0);
 		sp = ckrealloc(sp, grosslen);
 		sp->prev = prevstackp;
+		sp->size = grosslen;
 		stackp = sp;
 		stacknxt = (char *)sp + offsetof(struct stack_block, space);
 		stacknleft = newlen;
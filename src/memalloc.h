@@ -51,7 +51,40 @@ struct stackmark {
 	size_t stacknleft;
 };
 
+/*
+ * A pool hands out fixed size records, carving them from larger blocks
+ * and keeping freed ones on a list for reuse.
+ */
+struct pool {
+	size_t size;		/* size of a record */
+	void *free;		/* records ready for reuse */
+};
+
+#define POOL_INIT(type)	{ sizeof(type), NULL }
+
+/*
+ * Memory held by one kind of object, as reported by meminfo.
+ */
+struct memuse {
+	size_t count;		/* number of objects */
+	size_t bytes;		/* bytes allocated for them */
+};
+
+/*
+ * Counts kept by the allocator for the meminfo builtin.
+ */
+struct memstats {
+	unsigned long mallocs;	/* calls to ckmalloc and savestr */
+	unsigned long reallocs;	/* calls to ckrealloc */
+	unsigned long frees;	/* calls to ckfree */
+	size_t stackblocks;	/* number of allocated stack blocks */
+	size_t stackbytes;	/* size of the allocated stack blocks */
+	size_t stackpeak;	/* largest stackbytes so far */
+	size_t poolbytes;	/* size of the blocks carved into pools */
+};
 
+
+extern struct memstats memstats;
 extern char *stacknxt;
 extern size_t stacknleft;
 extern char *sstrend;
@@ -59,6 +92,7 @@ extern char *sstrend;
 void *ckmalloc(size_t);
 void *ckrealloc(void *, size_t);
 char *savestr(const char *);
+void *poolalloc(struct pool *);
 void *stalloc(size_t);
 void stunalloc(void *);
 void pushstackmark(struct stackmark *mark, size_t len);
@@ -108,6 +142,13 @@ _CHECKSTRSPACE(size_t n, char *p)
 #define ungrabstackstr(s, p) stunalloc((s))
 #define stackstrend() ((void *)sstrend)
 
-#define ckfree(p)	free((void *)(p))
+#define ckfree(p)	(memstats.frees++, free((void *)(p)))
+
+static inline void
+poolfree(struct pool *pool, void *p)
+{
+	*(void **)p = pool->free;
+	pool->free = p;
+}
 
 #endif
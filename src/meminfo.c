@@ -0,0 +1,162 @@
+/*-
+ * Copyright (c) 2026
+ *	The gwsh authors.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_MALLINFO2
+#include <malloc.h>
+#endif
+
+/*
+ * Memory accounting.  The meminfo builtin reports the objects each part
+ * of the shell holds and the memory allocated for them, together with the
+ * state of the stack allocator and the numbers of calls to the allocation
+ * routines.  The objects are counted by walking the tables when a report
+ * is asked for, so the only cost while the shell runs is keeping the
+ * counts in memstats.  When MEMINFOFILE is set, the report is appended to
+ * that file when the shell exits.
+ */
+
+#include "shell.h"
+#include "alias.h"
+#include "exec.h"
+#include "jobs.h"
+#include "main.h"
+#include "meminfo.h"
+#include "memalloc.h"
+#include "myhistedit.h"
+#include "mystring.h"
+#include "options.h"
+#include "output.h"
+#include "var.h"
+
+
+static void memline(struct output *, const char *, const struct memuse *);
+static void meminfo(struct output *);
+
+
+static void
+memline(struct output *out, const char *name, const struct memuse *mu)
+{
+	outfmt(out, "%-12s %10lu %12lu\n", name, (unsigned long)mu->count,
+	       (unsigned long)mu->bytes);
+}
+
+
+static void
+meminfo(struct output *out)
+{
+	struct memuse vars, funcs, cmds, dirs, aliases, jobs, hist;
+#ifdef HAVE_MALLINFO2
+	struct mallinfo2 mi;
+#endif
+
+	memset(&vars, 0, sizeof(vars));
+	funcs = cmds = dirs = aliases = jobs = hist = vars;
+	varmemuse(&vars);
+	cmdmemuse(&cmds, &funcs, &dirs);
+	aliasmemuse(&aliases);
+	jobmemuse(&jobs);
+#ifndef SMALL
+	histmemuse(&hist);
+#endif
+
+	outfmt(out, "%-12s %10s %12s\n", "", "objects", "bytes");
+	memline(out, "variables", &vars);
+	memline(out, "functions", &funcs);
+	memline(out, "commands", &cmds);
+	memline(out, "path index", &dirs);
+	memline(out, "aliases", &aliases);
+	memline(out, "jobs", &jobs);
+	memline(out, "history", &hist);
+	outfmt(out, "%-12s %10s %12lu\n", "pools", "-",
+	       (unsigned long)memstats.poolbytes);
+	outfmt(out, "%-12s %10lu %12lu\n", "stack",
+	       (unsigned long)memstats.stackblocks,
+	       (unsigned long)memstats.stackbytes);
+	outfmt(out, "%-12s %10s %12lu\n", "stack peak", "-",
+	       (unsigned long)memstats.stackpeak);
+#ifdef HAVE_MALLINFO2
+	mi = mallinfo2();
+	outfmt(out, "%-12s %10s %12lu\n", "heap", "-",
+	       (unsigned long)(mi.uordblks + mi.hblkhd));
+#endif
+	outfmt(out, "%-12s %10lu %12s\n", "malloc", memstats.mallocs, "-");
+	outfmt(out, "%-12s %10lu %12s\n", "realloc", memstats.reallocs, "-");
+	outfmt(out, "%-12s %10lu %12s\n", "free", memstats.frees, "-");
+}
+
+
+int
+meminfocmd(int argc, char **argv)
+{
+	meminfo(out1);
+	return 0;
+}
+
+
+/*
+ * Return whether a report is to be written when the shell exits.
+ */
+
+int
+meminfowanted(void)
+{
+	const char *file;
+
+	file = lookupvar("MEMINFOFILE");
+	return file && *file && getpid() == rootpid;
+}
+
+
+/*
+ * Append the report to $MEMINFOFILE.  Called when the shell exits;
+ * subshells leave it to the shell that created them.
+ */
+
+void
+meminfodump(void)
+{
+	struct output out;
+
+	if (!meminfowanted())
+		return;
+	out.fd = open(lookupvar("MEMINFOFILE"), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+	if (out.fd < 0)
+		return;
+	out.nextc = out.end = NULL;
+	out.error = 0;
+	outfmt(&out, "%s[%d]:\n", arg0, (int)rootpid);
+	meminfo(&out);
+	flushall();
+	close(out.fd);
+}
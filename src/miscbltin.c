@@ -48,6 +48,7 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <inttypes.h>
+#include <string.h>
 
 #include "shell.h"
 #include "options.h"
@@ -216,6 +217,125 @@ err:
 
 
 
+/*
+ * Chunk in which the mapfile builtin reads its input.
+ */
+#define MAPFILECHUNK 65536
+
+/*
+ * The mapfile builtin.  Lines of input, ended by the -d delimiter, become
+ * the positional parameters; without -t the delimiters are kept, as with
+ * bash's mapfile.  -s skips lines first and -n stops after that many.
+ * Input is read in large chunks and scanned with memchr, except that with
+ * -n on input that cannot seek it is read a byte at a time so as not to
+ * consume more than is used.
+ */
+
+int
+mapfilecmd(int argc, char **argv)
+{
+	char **newparam;
+	char *buf, *p, *q, *end;
+	size_t len, scan, chunk;
+	size_t nlines, want, nparam, size;
+	ssize_t n;
+	int count, skip;
+	int delim;
+	int tflag;
+	int fd;
+	int status;
+	int i;
+
+	delim = '\n';
+	count = skip = tflag = fd = 0;
+	while ((i = nextopt("d:n:s:tu:")) != '\0') {
+		switch (i) {
+		case 'd':
+			delim = *optionarg;
+			break;
+		case 'n':
+			count = number(optionarg);
+			break;
+		case 's':
+			skip = number(optionarg);
+			break;
+		case 't':
+			tflag = 1;
+			break;
+		case 'u':
+			fd = number(optionarg);
+			break;
+		}
+	}
+	endargs();
+
+	status = 0;
+	want = (size_t)skip + count;
+	chunk = count && lseek(fd, 0, SEEK_CUR) < 0 ? 1 : MAPFILECHUNK;
+	len = scan = nlines = 0;
+	for (;;) {
+		makestrspace(chunk, (char *)stackblock() + len);
+		buf = stackblock();
+		n = read(fd, buf + len, chunk);
+		if (n < 0) {
+			if (errno == EINTR && !pending_sig)
+				continue;
+			sh_warnx("%s", errnomsg());
+			status = 1;
+			break;
+		}
+		if (!n)
+			break;
+		len += n;
+		if (!count)
+			continue;
+		while (nlines < want &&
+		       (q = memchr(buf + scan, delim, len - scan))) {
+			scan = q - buf + 1;
+			nlines++;
+		}
+		if (nlines == want) {
+			if (len > scan)
+				lseek(fd, (off_t)scan - (off_t)len, SEEK_CUR);
+			len = scan;
+			break;
+		}
+		scan = len;
+	}
+	/* The parameters are left alone if the input could not be read. */
+	if (status)
+		return status;
+	buf = stackblock();
+	end = buf + len;
+
+	INTOFF;
+	size = 16;
+	newparam = ckmalloc(size * sizeof(*newparam));
+	nparam = 0;
+	for (p = buf; p < end; p = q + 1) {
+		if (!(q = memchr(p, delim, end - p)))
+			q = end;
+		if (skip) {
+			skip--;
+			continue;
+		}
+		if (nparam + 1 == size) {
+			size *= 2;
+			newparam = ckrealloc(newparam,
+					     size * sizeof(*newparam));
+		}
+		n = q - p + (!tflag && q < end);
+		newparam[nparam] = ckmalloc(n + 1);
+		*(char *)mempcpy(newparam[nparam++], p, n) = '\0';
+	}
+	newparam[nparam] = NULL;
+	setparamlist(newparam, nparam);
+	INTON;
+	return 0;
+}
+
+
+
 /*
  * umask builtin
  *
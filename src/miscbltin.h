@@ -30,6 +30,7 @@
 #define H_MISCBLTIN 1
 
 int readcmd(int, char **);
+int mapfilecmd(int, char **);
 int umaskcmd(int, char **);
 int ulimitcmd(int, char **);
 
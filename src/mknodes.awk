@@ -58,10 +58,14 @@ END {
 	calcsize = "\tif (n == NULL)\n\t\treturn;\n"
 	calcsize = calcsize "\tfuncblocksize += nodesize[n->type];\n"
 	calcsize = calcsize "\tswitch (n->type) {\n"
-	copy = "\tif (n == NULL)\n\t\treturn NULL;\n"
-	copy = copy "\tnew = funcblock;\n"
-	copy = copy "\tfuncblock = (char *) funcblock + nodesize[n->type];\n"
-	copy = copy "\tswitch (n->type) {\n"
+	encode = "\tif (n == NULL) {\n\t\tencbyte(0);\n\t\treturn;\n\t}\n"
+	encode = encode "\tencbyte(n->type + 1);\n"
+	encode = encode "\tswitch (n->type) {\n"
+	decode = "\tif ((type = *decp++) == 0)\n\t\treturn NULL;\n"
+	decode = decode "\tnew = funcblock;\n"
+	decode = decode "\tfuncblock = (char *) funcblock + nodesize[--type];\n"
+	decode = decode "\tnew->type = type;\n"
+	decode = decode "\tswitch (type) {\n"
 
 	for (i = 0; i < nodetypes["length"]; i++) {
 		define = define "#define "nodetypes[i]" "i"\n"
@@ -73,7 +77,8 @@ END {
 		for (j = 0; j < nodetypes["length"]; j++) {
 			if (nodetypes[nodetypes[j]] == s) {
 				calcsize = calcsize "\tcase "nodetypes[j]":\n"
-				copy = copy "\tcase "nodetypes[j]":\n"
+				encode = encode "\tcase "nodetypes[j]":\n"
+				decode = decode "\tcase "nodetypes[j]":\n"
 			}
 		}
 		struct = struct "struct "s" {\n"
@@ -81,38 +86,46 @@ END {
 		for (j = 0; j < nodedefs[s, "length"]; j++) {
 			m = nodedefs[s, j]
 			struct = struct "\t"types[nodedefs[s, m]]m";\n"
+			if (nodedefs[s, m] == "nodeptr") {
+				encode = encode "\t\tencnode(n->"s"."m");\n"
+				decode = decode "\t\tnew->"s"."m" = decnode();\n"
+			} else if (nodedefs[s, m] == "nodelist") {
+				encode = encode "\t\tencnodelist(n->"s"."m");\n"
+				decode = decode "\t\tnew->"s"."m" = decnodelist();\n"
+			} else if (nodedefs[s, m] == "string") {
+				encode = encode "\t\tencstr(n->"s"."m");\n"
+				decode = decode "\t\tnew->"s"."m" = decstr();\n"
+			} else if (nodedefs[s, m] == "int") {
+				encode = encode "\t\tencint(n->"s"."m");\n"
+				decode = decode "\t\tnew->"s"."m" = decint();\n"
+			}
 		}
 		for (j = nodedefs[s, "length"]; --j >= 1; ) {
 			m = nodedefs[s, j]
 			if (nodedefs[s, m] == "nodeptr") {
 				calcsize = calcsize "\t\tcalcsize(n->"s"."m");\n"
-				copy = copy"\t\tnew->"s"."m" = copynode(n->"s"."m");\n"
 			} else if (nodedefs[s, m] == "nodelist") {
 				calcsize = calcsize "\t\tsizenodelist(n->"s"."m");\n"
-				copy = copy"\t\tnew->"s"."m" = copynodelist(n->"s"."m");\n"
-			} else if (nodedefs[s, m] == "string") {
-				calcsize = calcsize "\t\tfuncstringsize += strlen(n->"s"."m") + 1;\n"
-				copy = copy"\t\tnew->"s"."m" = nodesavestr(n->"s"."m");\n"
-			} else if (m == "type" || nodedefs[s, m] == "tempstring") {
-			} else {
-				copy = copy"\t\tnew->"s"."m" = n->"s"."m";\n"
 			}
 		}
 		struct = struct "};\n\n"
 		calcsize = calcsize "\t\tbreak;\n"
-		copy = copy "\t\tbreak;\n"
+		encode = encode "\t\tbreak;\n"
+		decode = decode "\t\tbreak;\n"
 	}
 
 	sizes = sizes "};\n"
 	calcsize = calcsize "\t};\n"
-	copy = copy "\t};\n\tnew->type = n->type;\n"
+	encode = encode "\t};\n"
+	decode = decode "\t};\n"
 
 	subs["%DEFINE"]   = define
 	subs["%STRUCT"]   = struct
 	subs["%NODE"]     = node
 	subs["%SIZES"]    = sizes
 	subs["%CALCSIZE"] = calcsize
-	subs["%COPY"]     = copy
+	subs["%ENCODE"]   = encode
+	subs["%DECODE"]   = decode
 
 	print "/*\n * This file was generated by the mknodes script.\n */\n" >nodes_c
 	while (getline <nodes_c_pat > 0) {
@@ -45,6 +45,9 @@ extern int displayhist;
 extern int histop;
 
 void histedit(void);
+void histflush(void);
+struct memuse;
+void histmemuse(struct memuse *);
 void read_histfile(void);
 void sethistsize(const char *);
 void setterm(const char *);
@@ -329,6 +329,18 @@ setparam(char **argv)
 		*ap++ = savestr(*argv++);
 	}
 	*ap = NULL;
+	setparamlist(newparam, nparam);
+}
+
+
+/*
+ * Make a list obtained from malloc, whose strings are too, the shell
+ * parameters.
+ */
+
+void
+setparamlist(char **newparam, int nparam)
+{
 	freeparam(&shellparam);
 	shellparam.malloc = 1;
 	shellparam.nparam = nparam;
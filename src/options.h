@@ -107,6 +107,7 @@ extern char *optptr;		/* used by nextopt */
 int procargs(int, char **);
 void optschanged(void);
 void setparam(char **);
+void setparamlist(char **, int);
 void freeparam(volatile struct shparam *);
 int shiftcmd(int, char **);
 int setcmd(int, char **);
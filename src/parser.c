@@ -268,14 +268,35 @@ pipeline(void)
 	union node **np = &n;
 	struct nodelist *lp = NULL, *prev;
 	int negate;
+	int time;
+	int t;
 
 	negate = 0;
+	time = 0;
 	TRACE(("pipeline: entered\n"));
-	if (readtoken() == TNOT) {
-		negate = !negate;
+	/* time and ! may come in either order. */
+	for (;;) {
+		t = readtoken();
+		if (t == TTIME && !time) {
+			time = 1;
+			if (readtoken() == TWORD && !quoteflag &&
+			    equal(wordtext, "-p"))
+				time = 2;
+			else
+				tokpushback++;
+		} else if (t == TNOT && !negate)
+			negate = 1;
+		else
+			break;
 		checkkwd = CHKKWD | CHKALIAS | CHKCMD;
-	} else
-		tokpushback++;
+	}
+	tokpushback++;
+	/* time on its own times an empty command. */
+	if (time && (tokendlist[t] || t == TNL || t == TSEMI ||
+		     t == TBACKGND || t == TAND || t == TOR)) {
+		n = NULL;
+		goto prefix;
+	}
 	for (;;) {
 		*np = command();
 		if (readtoken() != TPIPE) {
@@ -298,12 +319,20 @@ pipeline(void)
 		np = &lp->n;
 		checkkwd = CHKNL | CHKKWD | CHKALIAS | CHKCMD;
 	}
+prefix:
 	if (negate) {
 		union node *n2 = stalloc(sizeof (struct nnot));
 		n2->type = NNOT;
 		n2->nnot.com = n;
 		n = n2;
 	}
+	if (time) {
+		union node *n2 = stalloc(sizeof (struct ntime));
+		n2->type = NTIME;
+		n2->ntime.posix = time == 2;
+		n2->ntime.com = n;
+		n = n2;
+	}
 	return n;
 }
 
@@ -634,8 +663,8 @@ fixredir(union node *n, const char *text, int err)
 	if (!err)
 		n->ndup.vname = NULL;
 
-	if (is_digit(text[0]) && text[1] == '\0')
-		n->ndup.dupfd = digit_val(text[0]);
+	if (is_number(text))
+		n->ndup.dupfd = number(text);
 	else if (text[0] == '-' && text[1] == '\0')
 		n->ndup.dupfd = -1;
 	else {
@@ -1280,6 +1309,14 @@ readtoken1_endword(char *out, char *eofmark)
 		 && (*out == '\0' || is_digit(*out))) {
 			readtoken1_parseredir(out, c);
 			return TREDIR;
+		} else if ((c == '>' || c == '<')
+		 && quoteflag == 0
+		 && len > 3 && *out == '{' && out[len - 2] == '}'
+		 && endofname(out + 1) == out + len - 2) {
+			/* {var}> redirection */
+			grabstackblock(len);
+			readtoken1_parseredir(out, c);
+			return TREDIR;
 		} else {
 			pungetc();
 		}
@@ -1354,8 +1391,9 @@ more_heredoc:
 
 /*
  * Parse a redirection operator.  The variable "out" points to a string
- * specifying the fd to be redirected.  The variable "c" contains the
- * first character of the redirection operator.
+ * specifying the fd, or the {var} to store a new fd in, to be redirected.
+ * The variable "c" contains the first character of the redirection
+ * operator.
  */
 
 static void
@@ -1420,7 +1458,18 @@ readtoken1_parseredir(char *out, int c)
 			break;
 		}
 	}
-	if (fd != '\0')
+	np->nfile.fdvar = NULL;
+	if (fd == '{') {
+		union node *n;
+
+		out[strlen(out) - 1] = '\0';
+		n = stalloc(sizeof (struct narg));
+		n->type = NARG;
+		n->narg.next = NULL;
+		n->narg.text = out + 1;
+		n->narg.backquote = NULL;
+		np->nfile.fdvar = n;
+	} else if (fd != '\0')
 		np->nfile.fd = digit_val(fd);
 	redirnode = np;
 }
@@ -1772,6 +1821,8 @@ expandstr(const char *ps, int flags)
 	union node n;
 	int saveprompt;
 
+	if (flags & EXP_PROMPT)
+		startprompt(ps);
 	setinputstring(ps);
 
 	saveprompt = doprompt;
@@ -1831,7 +1882,7 @@ getprompt(void *unused)
 #ifdef WITH_PARSER_LOCALE
 	savelocale = uselocale(LC_GLOBAL_LOCALE);
 #endif
-	prompt = expandstr(prompt, 0);
+	prompt = expandstr(prompt, EXP_PROMPT);
 #ifdef ENABLE_INTERNAL_COMPLETION
 	grabstackstr(prompt);
 #endif
@@ -0,0 +1,246 @@
+/*-
+ * Copyright (c) 2026
+ *	The gwsh authors.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/*
+ * Profiler.  When PROFILEFILE is set, every simple command is timed from
+ * the start of its expansion until it has completed, and the time is
+ * charged to the stack of commands and functions that led to it.  At exit
+ * the stacks are written in the folded format understood by flame graph
+ * tools: wall-clock time to $PROFILEFILE and CPU time to
+ * $PROFILEFILE.cpu, both in microseconds.  Subshells do not profile
+ * themselves; their time is charged to the command that created them.
+ */
+
+#include "shell.h"
+#include "prof.h"
+#include "options.h"
+#include "output.h"
+#include "memalloc.h"
+#include "mystring.h"
+#include "var.h"
+
+
+struct profnode {
+	struct profnode *parent;
+	struct profnode *child;		/* first callee */
+	struct profnode *next;		/* next callee of the parent */
+	struct profstamp start;		/* when the current call started */
+	struct profstamp total;		/* time spent including callees */
+	int func;			/* set if the node is a function call */
+	int line;			/* line number of the call */
+	char name[];
+};
+
+
+/* set if commands are being timed */
+int profiling;
+/* number of entered commands */
+int profdepth;
+
+static struct profnode *profroot;
+static struct profnode *profcur;
+
+
+static void profpath(struct output *, struct profnode *);
+static void profwrite(struct output *, struct profnode *, int);
+
+
+#ifdef mkinit
+INCLUDE "prof.h"
+
+RESET {
+	if (sub)
+		profiling = 0;
+	profleave(0);
+}
+#endif
+
+
+/*
+ * Called when PROFILEFILE is set or unset.
+ */
+
+void
+changeprofile(const char *val)
+{
+	profiling = !!*val;
+	if (profiling && !profroot) {
+		profroot = ckmalloc(sizeof(*profroot) + 1);
+		memset(profroot, 0, sizeof(*profroot) + 1);
+		profcur = profroot;
+	}
+}
+
+
+void
+profstamp(struct profstamp *ps)
+{
+	struct timespec ts;
+	struct rusage self, children;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	getrusage(RUSAGE_SELF, &self);
+	getrusage(RUSAGE_CHILDREN, &children);
+	ps->wall = (intmax_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	ps->cpu = ((intmax_t)self.ru_utime.tv_sec + self.ru_stime.tv_sec +
+		   children.ru_utime.tv_sec + children.ru_stime.tv_sec) *
+		  1000000 +
+		  self.ru_utime.tv_usec + self.ru_stime.tv_usec +
+		  children.ru_utime.tv_usec + children.ru_stime.tv_usec;
+}
+
+
+/*
+ * Enter a command that started at the given time.
+ */
+
+void
+profenter(const char *name, int func, int line, const struct profstamp *start)
+{
+	struct profnode *np;
+
+	for (np = profcur->child; np; np = np->next)
+		if (np->line == line && np->func == func &&
+		    !strcmp(np->name, name))
+			goto found;
+
+	np = ckmalloc(sizeof(*np) + strlen(name) + 1);
+	memset(np, 0, sizeof(*np));
+	strcpy(np->name, name);
+	np->func = func;
+	np->line = line;
+	np->parent = profcur;
+	np->next = profcur->child;
+	profcur->child = np;
+
+found:
+	np->start = *start;
+	profcur = np;
+	profdepth++;
+}
+
+
+/*
+ * Leave commands until only depth of them remain entered.
+ */
+
+void
+profleave(int depth)
+{
+	struct profstamp now;
+	struct profnode *np;
+
+	if (profdepth <= depth)
+		return;
+
+	profstamp(&now);
+	do {
+		np = profcur;
+		np->total.wall += now.wall - np->start.wall;
+		np->total.cpu += now.cpu - np->start.cpu;
+		profcur = np->parent;
+	} while (--profdepth > depth);
+}
+
+
+/*
+ * Write out the collected stacks.  Called when the shell exits.
+ */
+
+void
+profdump(void)
+{
+	const char *file;
+	char *name;
+	struct output out;
+	int cpu;
+
+	profleave(0);
+	if (!profiling)
+		return;
+	file = lookupvar("PROFILEFILE");
+
+	for (cpu = 0; cpu < 2; cpu++) {
+		name = (char *)file;
+		if (cpu)
+			xasprintf(&name, "%s.cpu", file);
+		out.fd = open(name, O_WRONLY | O_CREAT | O_APPEND, 0666);
+		if (out.fd < 0)
+			continue;
+		out.nextc = out.end = NULL;
+		out.error = 0;
+		profwrite(&out, profroot, cpu);
+		flushall();
+		close(out.fd);
+	}
+}
+
+
+static void
+profpath(struct output *out, struct profnode *np)
+{
+	if (!np->parent) {
+		outstr(arg0, out);
+		return;
+	}
+	profpath(out, np->parent);
+	outfmt(out, np->func ? ";%s():%d" : ";%s:%d", np->name, np->line);
+}
+
+
+/*
+ * Write one line per stack with the time spent in its innermost command
+ * itself, excluding its callees.
+ */
+
+static void
+profwrite(struct output *out, struct profnode *np, int cpu)
+{
+	struct profnode *cp;
+	intmax_t self;
+
+	self = cpu ? np->total.cpu : np->total.wall;
+	for (cp = np->child; cp; cp = cp->next) {
+		self -= cpu ? cp->total.cpu : cp->total.wall;
+		profwrite(out, cp, cpu);
+	}
+	if (np->parent && self > 0) {
+		profpath(out, np);
+		outfmt(out, " %" PRIdMAX "\n", self);
+	}
+}
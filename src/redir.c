@@ -43,6 +43,9 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#ifdef HAVE_MEMFD_CREATE
+#include <sys/mman.h>
+#endif
 
 /*
  * Code for dealing with input/output redirection.
@@ -58,6 +61,10 @@
 #include "output.h"
 #include "memalloc.h"
 #include "error.h"
+#include "exec.h"
+#include "mystring.h"
+#include "show.h"
+#include "var.h"
 
 
 #define EMPTY -2		/* marks an unused slot in redirtab */
@@ -79,9 +86,41 @@ struct redirtab {
 
 MKINIT struct redirtab *redirlist;
 
+
+/*
+ * Files opened with >> inside a loop or function are kept open once they
+ * have been opened a second time, so that running the same redirection
+ * again only has to check that the name still refers to the same file.
+ * Entries are discarded when the loop or function they were opened in
+ * finishes.  Files opened for reading are not cached, as redirections
+ * sharing a descriptor would share its offset.
+ */
+
+#define FDCACHESIZE 8
+
+struct fdcache {
+	struct fdcache *next;
+	int fd;			/* descriptor, close-on-exec and above 9 */
+	int depth;		/* value of fdcachedepth when opened */
+	dev_t dev;
+	ino_t ino;
+	char fname[1];
+};
+
+static struct fdcache *fdcachelist;
+MKINIT int fdcachedepth;
+static unsigned fdcacheseen[FDCACHESIZE];	/* hashes of recent opens */
+static int fdcacheseenpos;
+
 static int openredirect(union node *);
 static void dupredirect(union node *, int);
 static int openhere(union node *);
+static int userfd(int);
+static void redirectvar(union node *);
+static void traceredir(union node *, int, int);
+static int fdcacheget(const char *);
+static void fdcacheput(const char *, int);
+static int fdcached(int);
 
 
 /*
@@ -104,10 +143,24 @@ redirect(union node *redir, int flags)
 		return;
 	sv = NULL;
 	INTOFF;
+	if (etracefd >= 0) {
+		/* Events so far go to the descriptor as it is now. */
+		for (n = redir; n; n = n->nfile.next) {
+			if (!n->nfile.fdvar && n->nfile.fd == etracefd) {
+				etraceflush();
+				break;
+			}
+		}
+	}
 	if (likely(flags & REDIR_PUSH))
 		sv = redirlist;
 	n = redir;
 	do {
+		if (n->nfile.fdvar) {
+			redirectvar(n);
+			continue;
+		}
+
 		fd = n->nfile.fd;
 
 		if (sv) {
@@ -118,6 +171,9 @@ redirect(union node *redir, int flags)
 
 		newfd = openredirect(n);
 
+		if (etracefd >= 0)
+			traceredir(n, fd, newfd);
+
 		if (fd == newfd)
 			continue;
 
@@ -136,6 +192,16 @@ openredirect(union node *redir)
 	char *fname;
 	int f;
 
+	switch (redir->nfile.type) {
+	case NTO:
+	case NCLOBBER:
+	case NFROMTO:
+	case NAPPEND:
+		/* The file may be a new command. */
+		pathgen++;
+		break;
+	}
+
 	switch (redir->nfile.type) {
 	case NFROM:
 		fname = redir->nfile.expfname;
@@ -176,13 +242,16 @@ openredirect(union node *redir)
 		break;
 	case NAPPEND:
 		fname = redir->nfile.expfname;
+		if ((f = fdcacheget(fname)) >= 0)
+			break;
 		if ((f = xopen(fname, O_WRONLY|O_CREAT|O_APPEND)) < 0)
 			goto ecreate;
+		fdcacheput(fname, f);
 		break;
 	case NTOFD:
 	case NFROMFD:
 		f = redir->ndup.dupfd;
-		if (f >= 0 && fcntl(f, F_GETFD) < 0)
+		if (f >= 0 && !userfd(f))
 			sh_error("%d: %s", f, errnomsg());
 		break;
 	default:
@@ -223,7 +292,8 @@ dupredirect(union node *redir, int f)
 	} else if (dup2(f, fd) < 0)
 		errmsg = errnomsg();
 
-	close(f);
+	if (!fdcached(f))
+		close(f);
 	if (errmsg)
 		goto err;
 
@@ -235,9 +305,281 @@ err:
 
 
 /*
- * Handle here documents.  Normally we fork off a process to write the
- * data to a pipe.  If the document is short, we can stuff the data in
- * the pipe without forking.
+ * Return the cached descriptor for a redirection, or -1.
+ */
+
+static int
+fdcacheget(const char *fname)
+{
+	struct fdcache *fc, **fcp;
+	struct stat sb;
+
+	for (fcp = &fdcachelist; (fc = *fcp); fcp = &fc->next) {
+		if (equal(fc->fname, fname))
+			goto found;
+	}
+	return -1;
+
+found:
+	*fcp = fc->next;
+	if (stat(fname, &sb) < 0 || sb.st_dev != fc->dev ||
+	    sb.st_ino != fc->ino) {
+		/* Removed, renamed or replaced. */
+		close(fc->fd);
+		ckfree(fc);
+		return -1;
+	}
+	fc->next = fdcachelist;
+	fdcachelist = fc;
+	return fc->fd;
+}
+
+
+/*
+ * Remember a descriptor opened for a redirection, if inside a loop or
+ * function and the same file was opened recently.  The least recently
+ * used entry makes way for it if the cache is full.
+ */
+
+static void
+fdcacheput(const char *fname, int f)
+{
+	struct fdcache *fc, **fcp;
+	struct stat sb;
+	const char *p;
+	unsigned h;
+	int n;
+
+	if (!fdcachedepth)
+		return;
+	h = 0;
+	for (p = fname; *p; p++)
+		h = h * 31 + (unsigned char)*p;
+	for (n = 0; fdcacheseen[n] != h; n++) {
+		if (n == FDCACHESIZE - 1) {
+			fdcacheseen[fdcacheseenpos] = h;
+			fdcacheseenpos = (fdcacheseenpos + 1) % FDCACHESIZE;
+			return;
+		}
+	}
+	if (fstat(f, &sb) < 0 || !S_ISREG(sb.st_mode))
+		return;
+	n = 0;
+	for (fcp = &fdcachelist; (fc = *fcp); fcp = &fc->next) {
+		if (++n == FDCACHESIZE) {
+			*fcp = NULL;
+			close(fc->fd);
+			ckfree(fc);
+			break;
+		}
+	}
+	fc = ckmalloc(sizeof(*fc) + strlen(fname));
+#ifdef F_DUPFD_CLOEXEC
+	fc->fd = fcntl(f, F_DUPFD_CLOEXEC, 10);
+#else
+	if ((fc->fd = fcntl(f, F_DUPFD, 10)) >= 0)
+		fcntl(fc->fd, F_SETFD, FD_CLOEXEC);
+#endif
+	if (fc->fd < 0) {
+		ckfree(fc);
+		return;
+	}
+	fc->depth = fdcachedepth;
+	fc->dev = sb.st_dev;
+	fc->ino = sb.st_ino;
+	strcpy(fc->fname, fname);
+	fc->next = fdcachelist;
+	fdcachelist = fc;
+}
+
+
+static int
+fdcached(int f)
+{
+	struct fdcache *fc;
+
+	for (fc = fdcachelist; fc; fc = fc->next) {
+		if (fc->fd == f)
+			return 1;
+	}
+	return 0;
+}
+
+
+/*
+ * Called on entry to a loop or function.  The value returned is passed to
+ * popfdcache() when it finishes.
+ */
+
+int
+pushfdcache(void)
+{
+	return fdcachedepth++;
+}
+
+
+/*
+ * Close the descriptors opened since the matching pushfdcache().
+ */
+
+void
+popfdcache(int depth)
+{
+	struct fdcache *fc, **fcp;
+
+	INTOFF;
+	fdcachedepth = depth;
+	fcp = &fdcachelist;
+	while ((fc = *fcp)) {
+		if (fc->depth > depth) {
+			*fcp = fc->next;
+			close(fc->fd);
+			ckfree(fc);
+		} else
+			fcp = &fc->next;
+	}
+	INTON;
+}
+
+
+/*
+ * Check that a descriptor named in a redirection is open and not one the
+ * shell uses itself; those are above 9 and close-on-exec.
+ */
+
+static int
+userfd(int f)
+{
+	int flags = fcntl(f, F_GETFD);
+
+	if (flags < 0)
+		return 0;
+	if (f > 9 && flags & FD_CLOEXEC) {
+		errno = EBADF;
+		return 0;
+	}
+	return 1;
+}
+
+
+/*
+ * Handle a {var} redirection.  The file is opened on a new descriptor
+ * above 9 whose number is stored in the variable, or with >&- the
+ * descriptor named by the variable is closed.  Unlike other redirections,
+ * these are not undone when the command finishes.
+ */
+
+static void
+redirectvar(union node *redir)
+{
+	const char *name = redir->nfile.fdvar->narg.text;
+	const char *val;
+	int isdup;
+	int f;
+	int newfd;
+
+	isdup = redir->nfile.type == NTOFD || redir->nfile.type == NFROMFD;
+	if (isdup && redir->ndup.dupfd < 0) {
+		val = lookupvar(name);
+		if (!val || !is_number(val))
+			sh_error("%s: Bad fd number", name);
+		f = number(val);
+		if (etracefd >= 0)
+			traceredir(redir, f, -1);
+		if (f == etracefd)
+			etraceflush();
+		if (userfd(f))
+			close(f);
+		return;
+	}
+
+	f = openredirect(redir);
+	newfd = fcntl(f, F_DUPFD, 10);
+	if (!isdup && !fdcached(f)) {
+		int e = errno;
+		close(f);
+		errno = e;
+	}
+	if (newfd < 0)
+		sh_error("%s: %s", name, errnomsg());
+	if (etracefd >= 0)
+		traceredir(redir, newfd, f);
+	setvarint(name, newfd, 0);
+}
+
+
+/*
+ * Record a redirection in the execution trace.
+ */
+
+static void
+traceredir(union node *redir, int fd, int f)
+{
+	static const char ops[][3] = {
+		[NTO - NTO] = ">", [NCLOBBER - NTO] = ">|",
+		[NFROM - NTO] = "<", [NFROMTO - NTO] = "<>",
+		[NAPPEND - NTO] = ">>", [NTOFD - NTO] = ">&",
+		[NFROMFD - NTO] = "<&", [NHERE - NTO] = "<<",
+		[NXHERE - NTO] = "<<",
+	};
+	int type = redir->nfile.type;
+
+	etracebegin("redir");
+	etraceint("fd", fd);
+	etracestr("op", ops[type - NTO]);
+	switch (type) {
+	case NTOFD:
+	case NFROMFD:
+		etraceint("dupfd", f);
+		break;
+	case NHERE:
+	case NXHERE:
+		break;
+	default:
+		etracestr("file", redir->nfile.expfname);
+		break;
+	}
+	etraceend();
+}
+
+
+/*
+ * Write a long here document to an anonymous file, and return a descriptor
+ * for it positioned at the start, or -1 if no such file can be created.
+ */
+
+static int
+openheretmp(const char *p, size_t len)
+{
+	int fd = -1;
+
+#ifdef HAVE_MEMFD_CREATE
+	fd = memfd_create("sh-here", 0);
+#endif
+#ifdef O_TMPFILE
+	if (fd < 0) {
+		const char *tmpdir = lookupvar("TMPDIR");
+
+		if (!tmpdir || !*tmpdir)
+			tmpdir = "/tmp";
+		fd = open(tmpdir, O_RDWR | O_TMPFILE, 0600);
+	}
+#endif
+	if (fd < 0)
+		return -1;
+	if (xwrite(fd, p, len) < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+/*
+ * Handle here documents.  If the document is short, we stuff the data in
+ * a pipe.  Longer documents are written to an anonymous file, which also
+ * gives the command a descriptor it can seek in or map.  Only if that is
+ * not possible do we fork off a process to write the data to a pipe.
  */
 
 static int
@@ -246,6 +588,7 @@ openhere(union node *redir)
 	char *p;
 	int pip[2];
 	size_t len = 0;
+	int fd;
 
 	p = redir->nhere.doc->narg.text;
 	if (redir->type == NXHERE) {
@@ -253,10 +596,13 @@ openhere(union node *redir)
 		p = stackblock();
 	}
 
+	len = strlen(p);
+	if (len > PIPESIZE && (fd = openheretmp(p, len)) >= 0)
+		return fd;
+
 	if (pipe(pip) < 0)
 		sh_error("Pipe call failed");
 
-	len = strlen(p);
 	if (len <= PIPESIZE) {
 		xwrite(pip[1], p, len);
 		goto out;
@@ -293,6 +639,8 @@ popredir(int drop)
 
 	INTOFF;
 	rp = redirlist;
+	if (etracefd >= 0 && etracefd < 10 && rp->renamed[etracefd] != EMPTY)
+		etraceflush();
 	for (i = 0 ; i < 10 ; i++) {
 		switch (rp->renamed[i]) {
 		case CLOSED:
@@ -326,6 +674,18 @@ RESET {
 	 * Discard all saved file descriptors.
 	 */
 	unwindredir(0, sub);
+
+	/*
+	 * Close cached descriptors.  A subshell stays inside the loops of
+	 * its parent, but must not share the offsets of their files.
+	 */
+	if (sub) {
+		int depth = fdcachedepth;
+
+		popfdcache(-1);
+		fdcachedepth = depth;
+	} else
+		popfdcache(0);
 }
 
 #endif
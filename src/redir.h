@@ -49,5 +49,7 @@ int savefd(int, int);
 int redirectsafe(union node *, int);
 void unwindredir(struct redirtab *stop, int);
 struct redirtab *pushredir(union node *redir);
+int pushfdcache(void);
+void popfdcache(int);
 
 #endif
@@ -37,6 +37,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "shell.h"
 #include "parser.h"
@@ -44,6 +47,7 @@
 #include "mystring.h"
 #include "show.h"
 #include "options.h"
+#include "output.h"
 
 
 #ifdef DEBUG
@@ -141,7 +145,9 @@ shcmd(union node *cmd, FILE *fp)
 			case NFROMTO:	s = "<>"; dftfd = 0; break;
 			default:  	s = "*error*"; dftfd = 0; break;
 		}
-		if (np->nfile.fd != dftfd)
+		if (np->nfile.fdvar)
+			fprintf(fp, "{%s}", np->nfile.fdvar->narg.text);
+		else if (np->nfile.fd != dftfd)
 			fprintf(fp, "%d", np->nfile.fd);
 		fputs(s, fp);
 		if (np->nfile.type == NTOFD || np->nfile.type == NFROMFD) {
@@ -407,3 +413,182 @@ opentrace(void)
 	fputs("\nTracing started.\n", tracefile);
 }
 #endif /* DEBUG */
+
+
+
+/*
+ * Structured execution trace.  When TRACEFD names an open file descriptor,
+ * events are written to it as JSON objects, one per line, each stamped with
+ * the monotonic clock in microseconds and the process ID.  Events are
+ * buffered and only written out when the buffer fills up, or before the
+ * shell forks, execs, redirects or restores the trace descriptor, or
+ * exits.
+ */
+
+int etracefd = -1;
+intmax_t etraceexp = 1000;
+MKINIT pid_t etracepid;
+static char etracebuf[8192];
+static size_t etracelen;
+
+#ifdef mkinit
+INCLUDE "show.h"
+RESET {
+	if (sub)
+		etracepid = 0;
+}
+#endif
+
+
+void
+changetracefd(const char *val)
+{
+	etraceflush();
+	etracefd = is_number(val) ? atoi(val) : -1;
+}
+
+
+void
+changetraceexp(const char *val)
+{
+	etraceexp = is_number(val) ? atomax10(val) : 1000;
+}
+
+
+intmax_t
+etracenow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (intmax_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+void
+etraceflush(void)
+{
+	if (!etracelen)
+		return;
+	if (etracefd >= 0)
+		xwrite(etracefd, etracebuf, etracelen);
+	etracelen = 0;
+}
+
+
+static void
+etraceput(const char *p, size_t len)
+{
+	if (len > sizeof(etracebuf) - etracelen) {
+		etraceflush();
+		if (len > sizeof(etracebuf)) {
+			xwrite(etracefd, p, len);
+			return;
+		}
+	}
+	memcpy(etracebuf + etracelen, p, len);
+	etracelen += len;
+}
+
+
+static void
+etracekey(const char *key)
+{
+	etraceput(",\"", 2);
+	etraceput(key, strlen(key));
+	etraceput("\":", 2);
+}
+
+
+static void
+etracequote(const char *s)
+{
+	const char *p;
+	char buf[8];
+
+	etraceput("\"", 1);
+	for (;;) {
+		for (p = s; (unsigned char)*p >= 0x20 && *p != '"' &&
+			    *p != '\\' && *p != 0x7f; p++)
+			continue;
+		etraceput(s, p - s);
+		if (!*p)
+			break;
+		if (*p == '"' || *p == '\\') {
+			buf[0] = '\\';
+			buf[1] = *p;
+			etraceput(buf, 2);
+		} else
+			etraceput(buf, fmtstr(buf, sizeof(buf), "\\u%04x",
+					      (unsigned char)*p));
+		s = p + 1;
+	}
+	etraceput("\"", 1);
+}
+
+
+/*
+ * Start an event, returning its timestamp.
+ */
+
+intmax_t
+etracebegin(const char *ev)
+{
+	intmax_t now = etracenow();
+
+	if (!etracepid)
+		etracepid = getpid();
+	etraceput("{\"t\":", 5);
+	etraceint(NULL, now);
+	etracekey("pid");
+	etraceint(NULL, etracepid);
+	etracekey("ev");
+	etracequote(ev);
+	return now;
+}
+
+
+void
+etraceint(const char *key, intmax_t val)
+{
+	int len = max_int_length(sizeof(val));
+	char buf[len];
+
+	if (key)
+		etracekey(key);
+	etraceput(buf, fmtstr(buf, len, "%" PRIdMAX, val));
+}
+
+
+void
+etracestr(const char *key, const char *val)
+{
+	etracekey(key);
+	etracequote(val);
+}
+
+
+void
+etraceargv(const char *key, char **argv)
+{
+	etracekey(key);
+	etraceput("[", 1);
+	if (*argv) {
+		for (;;) {
+			etracequote(*argv);
+			if (!*++argv)
+				break;
+			etraceput(",", 1);
+		}
+	}
+	etraceput("]", 1);
+}
+
+
+void
+etraceend(void)
+{
+	etraceput("}\n", 2);
+	if (etracelen > sizeof(etracebuf) / 2)
+		etraceflush();
+}
@@ -47,4 +47,19 @@ void trputs(const char *);
 void opentrace(void);
 #endif
 
+#include <inttypes.h>
+
+extern int etracefd;
+extern intmax_t etraceexp;
+
+void changetracefd(const char *);
+void changetraceexp(const char *);
+intmax_t etracenow(void);
+void etraceflush(void);
+intmax_t etracebegin(const char *);
+void etraceint(const char *, intmax_t);
+void etracestr(const char *, const char *);
+void etraceargv(const char *, char **);
+void etraceend(void);
+
 #endif
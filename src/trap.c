@@ -45,11 +45,15 @@
 #include "main.h"
 #include "nodes.h"	/* for other headers */
 #include "eval.h"
+#include "input.h"
+#include "parser.h"
 #include "jobs.h"
 #include "show.h"
 #include "options.h"
 #include "syntax.h"
 #include "output.h"
+#include "prof.h"
+#include "meminfo.h"
 #include "memalloc.h"
 #include "error.h"
 #include "trap.h"
@@ -70,10 +74,16 @@
 
 /* trap handler commands */
 static char *trap[NSIG];
+/* trap handler commands as parsed when first run */
+static struct funcnode *trapnode[NSIG];
 /* number of non-null traps */
 int trapcnt;
 /* current value of signal */
 char sigmode[NSIG - 1];
+/* number of signals other than SIGCHLD that are caught */
+int catchcnt;
+/* catch SIGINT as if interactive, for a process group that cannot see it */
+int catchint;
 /* indicates specified signal received */
 static char gotsig[NSIG - 1];
 /* last pending signal */
@@ -85,6 +95,7 @@ extern const char *signal_names[];
 extern const int signal_names_length;
 
 static int decode_signum(const char *);
+static void runtrap(int);
 
 sigset_t sigset_empty, sigset_full;
 
@@ -158,6 +169,8 @@ trapcmd(int argc, char **argv)
 					trapcnt--;
 				ckfree(trap[signo]);
 			}
+			freefunc(trapnode[signo]);
+			trapnode[signo] = NULL;
 			trap[signo] = action;
 			if (signo != 0)
 				setsignal(signo, 0);
@@ -186,6 +199,8 @@ clear_traps(void)
 			if (!trapcnt) {
 				ckfree(*tp);
 				*tp = NULL;
+				freefunc(trapnode[tp - trap]);
+				trapnode[tp - trap] = NULL;
 			} else if (tp != &trap[0])
 				setsignal(tp - trap, 0);
 		}
@@ -225,7 +240,7 @@ setsignal(int signo, int subshell)
 	if (action == S_DFL && !subshell) {
 		switch (signo) {
 		case SIGINT:
-			if (iflag)
+			if (iflag || catchint)
 				action = S_CATCH;
 			break;
 		case SIGQUIT:
@@ -281,6 +296,8 @@ setsignal(int signo, int subshell)
 	default:
 		act.sa_handler = SIG_DFL;
 	}
+	if (signo != SIGCHLD)
+		catchcnt += (action == S_CATCH) - (tsig == S_CATCH);
 	*t = action;
 	act.sa_flags = 0;
 	sigfillset(&act.sa_mask);
@@ -295,6 +312,8 @@ void
 ignoresig(int signo)
 {
 	if (sigmode[signo - 1] != S_IGN && sigmode[signo - 1] != S_HARD_IGN) {
+		if (sigmode[signo - 1] == S_CATCH)
+			catchcnt--;
 		signal(signo, SIG_IGN);
 		sigmode[signo - 1] = S_IGN;
 	}
@@ -336,7 +355,6 @@ onsig(int signo)
 void
 dotrap(void)
 {
-	char *p;
 	char *q;
 	int i;
 	int status;
@@ -350,9 +368,8 @@ dotrap(void)
 	pending_sig = 0;
 	barrier();
 
-	for (i = 0, q = gotsig; i < NSIG - 1; i++, q++) {
-		if (!*q)
-			continue;
+	for (q = gotsig; (q = memchr(q, 1, gotsig + NSIG - 1 - q)); q++) {
+		i = q - gotsig;
 
 		if (evalskip) {
 			pending_sig = i + 1;
@@ -361,8 +378,7 @@ dotrap(void)
 
 		*q = 0;
 
-		p = trap[i + 1];
-		evalstring(p, 0);
+		runtrap(i + 1);
 		if (!(evalskip & SKIPFUNCR))
 			exitstatus = savestatus;
 	}
@@ -372,6 +388,57 @@ dotrap(void)
 
 
 
+/*
+ * Run the trap for a signal.  The commands are parsed the first time the
+ * trap is run and kept until the trap is changed, so aliases in them are
+ * expanded only once, as in a function.
+ */
+
+static void
+runtrap(int signo)
+{
+	struct funcnode *f;
+	struct stackmark smark;
+	union node *n, *list;
+
+	if (!trap[signo] || !*trap[signo])
+		return;
+
+	if (!(f = trapnode[signo])) {
+		setstackmark(&smark);
+		setinputstring(sstrdup(trap[signo]));
+		list = NULL;
+		while ((n = parsecmd(0)) != NEOF) {
+			if (!n)
+				continue;
+			if (list) {
+				union node *semi = stalloc(sizeof(struct nbinary));
+
+				semi->type = NSEMI;
+				semi->nbinary.ch1 = list;
+				semi->nbinary.ch2 = n;
+				n = semi;
+			}
+			list = n;
+		}
+		popfile();
+		if (list) {
+			INTOFF;
+			f = trapnode[signo] = copyfunc(list);
+			INTON;
+		}
+		popstackmark(&smark);
+		if (!f)
+			return;
+	}
+
+	f->count++;
+	evaltree(functree(f), 0);
+	freefunc(f);
+}
+
+
+
 /*
  * Called to exit the shell.
  */
@@ -398,6 +465,9 @@ exitshell(void)
 	}
 out:
 	setjmp(loc);
+	profdump();
+	meminfodump();
+	etraceflush();
 	flushall();
 	releasetty();
 	_exit(savestatus);
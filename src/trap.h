@@ -45,6 +45,8 @@
 
 extern int trapcnt;
 extern char sigmode[];
+extern int catchcnt;
+extern int catchint;
 extern volatile sig_atomic_t pending_sig;
 extern int gotsigchld;
 
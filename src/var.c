@@ -59,6 +59,7 @@
 #include "nodes.h"	/* for other headers */
 #include "eval.h"
 #include "exec.h"
+#include "jobs.h"
 #include "syntax.h"
 #include "options.h"
 #include "mail.h"
@@ -67,6 +68,7 @@
 #include "error.h"
 #include "mystring.h"
 #include "parser.h"
+#include "prof.h"
 #include "show.h"
 #ifndef SMALL
 #include "myhistedit.h"
@@ -84,6 +86,14 @@ struct localvar_list {
 
 MKINIT struct localvar_list *localvar_stack;
 
+/*
+ * Variables, localvar records and frames are taken from pools so that
+ * function calls and local do not keep going back to malloc.
+ */
+static struct pool varpool = POOL_INIT(struct var);
+static struct pool localvarpool = POOL_INIT(struct localvar);
+static struct pool localvarlistpool = POOL_INIT(struct localvar_list);
+
 const char defpathvar[] =
 	"PATH\0/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin\0";
 char defps1var[] = "PS1\0$ \0";
@@ -108,6 +118,10 @@ struct var varinit[] = {
 	{ 0,	VSTRFIXED|VTEXTFIXED,		"PS4\0+ ",	0 },
 	{ 0,	VSTRFIXED|VTEXTFIXED|VLATEFUNC,	defoptindvar,	getoptsreset },
 	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"PWD\0\0\1",	0 },
+	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"JOBMAX\0\0\1",	changejobmax },
+	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"PROFILEFILE\0\0\1",	changeprofile },
+	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"TRACEFD\0\0\1",	changetracefd },
+	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"TRACEEXPTIME\0\0\1",	changetraceexp },
 #ifdef WITH_LINENO
 	{ 0,	VSTRFIXED|VTEXTFIXED,		linenovar,	0 },
 #endif
@@ -125,6 +139,12 @@ struct var varinit[] = {
 #endif
 };
 
+#define NVARINIT (sizeof(varinit) / sizeof(varinit[0]))
+
+/* the text and flags of the builtin variables before the environment */
+static const char *varinittext[NVARINIT];
+static int varinitflags[NVARINIT];
+
 static struct var *vartab[VTABSIZE];
 
 static struct var **hashvar(const char *);
@@ -193,8 +213,10 @@ initvar(void)
 	struct var **vpp;
 
 	vp = varinit;
-	end = vp + sizeof(varinit) / sizeof(varinit[0]);
+	end = vp + NVARINIT;
 	do {
+		varinittext[vp - varinit] = vp->text;
+		varinitflags[vp - varinit] = vp->flags;
 		vpp = hashvar(vp->text);
 		vp->next = *vpp;
 		*vpp = vp;
@@ -303,7 +325,7 @@ setvareq(char *s, int flags)
 		if ((saveflags & (VEXPORT|VREADONLY|VUNSET)) == VUNSET) {
 			if (!(flags & VSTRFIXED)) {
 				*vpp = vp->next;
-				ckfree(vp);
+				poolfree(&varpool, vp);
 out_free:
 				if ((flags & (VTEXTFIXED|VSTACK|VNOSAVE)) == VNOSAVE)
 					ckfree(s);
@@ -315,7 +337,7 @@ out_free:
 		if ((flags & (VEXPORT|VREADONLY|VSTRFIXED|VUNSET)) == VUNSET)
 			goto out_free;
 		/* not found */
-		vp = ckmalloc(sizeof (*vp));
+		vp = poolalloc(&varpool);
 		vp->local = NULL;
 		vp->next = *vpp;
 		vp->func = NULL;
@@ -549,7 +571,7 @@ mklocal(char *name)
 			goto setvar;
 	}
 
-	lvp = ckmalloc(sizeof (struct localvar));
+	lvp = poolalloc(&localvarpool);
 	lvp->next = localvar_stack->lv;
 	localvar_stack->lv = lvp;
 
@@ -600,7 +622,7 @@ poplocalvars(int keep)
 	localvar_stack = ll->next;
 
 	next = ll->lv;
-	ckfree(ll);
+	poolfree(&localvarlistpool, ll);
 
 	while ((lvp = next) != NULL) {
 		next = lvp->next;
@@ -643,7 +665,7 @@ poplocalvars(int keep)
 					(*vp->func)(strchr(lvp->text, '\0') + 1);
 			}
 		}
-		ckfree(lvp);
+		poolfree(&localvarpool, lvp);
 	}
 	INTON;
 }
@@ -658,7 +680,7 @@ pushlocalvars(void)
 	struct localvar_list *ll;
 
 	INTOFF;
-	ll = ckmalloc(sizeof(*ll));
+	ll = poolalloc(&localvarlistpool);
 	ll->lv = NULL;
 	ll->next = localvar_stack;
 	localvar_stack = ll;
@@ -676,6 +698,176 @@ unwindlocalvars(struct localvar_list *stop, int keep)
 }
 
 
+/*
+ * Take on the environment env in place of the current one, as a newly
+ * started shell would: every variable is unset, except that the builtin
+ * ones go back to their initial values, the strings in env are imported,
+ * and IFS and OPTIND are reset.  Readonly variables keep their values but
+ * are exported only if env has them.
+ */
+
+void
+adoptenv(char **env)
+{
+	struct var **vpp;
+	struct var *vp;
+	struct var *next;
+	const char *text;
+	int i;
+
+	INTOFF;
+	for (vpp = vartab ; vpp < vartab + VTABSIZE ; vpp++) {
+		for (vp = *vpp ; vp ; vp = next) {
+			next = vp->next;
+			if (vp->flags & VREADONLY) {
+				vp->flags &= ~VEXPORT;
+				continue;
+			}
+			if (!(vp->flags & VSTRFIXED)) {
+				unsetvar(vp->text);
+				continue;
+			}
+			i = vp - varinit;
+			text = varinittext[i];
+			if (vp->text == text &&
+			    !((vp->flags ^ varinitflags[i]) & VUNSET)) {
+				vp->flags &= ~VEXPORT;
+				continue;
+			}
+			setvar(text, varinitflags[i] & VUNSET ? NULL :
+				     text + strlen(text) + 1, 0);
+			vp->flags &= ~VEXPORT;
+		}
+	}
+	for (; *env ; env++) {
+		const char *p = endofname(*env);
+
+		if (p == *env || *p != '=')
+			continue;
+		vp = *findvar(hashvar(*env), *env);
+		if (vp && vp->flags & VREADONLY)
+			vp->flags |= VEXPORT;
+		else
+			setvareq(*env, VEXPORT);
+	}
+	setvareq(defifsvar, VTEXTFIXED);
+	setvareq(defoptindvar, VTEXTFIXED);
+	INTON;
+}
+
+
+/*
+ * Record the state of every variable, so that restorevars can put it back
+ * after a subshell run in this process.  Like mklocal, this marks the
+ * variables so that their structures and current text are not freed.
+ * Called with interrupts off.
+ */
+
+struct varsave {
+	struct var *vp;		/* the variable, or NULL at the end */
+	int flags;		/* saved flags */
+	const char *text;	/* saved text */
+	struct localvar_list *local;
+};
+
+struct varsave *
+savevars(void)
+{
+	struct var **vpp;
+	struct var *vp;
+	struct varsave *vs, *sp;
+	int n = 1;
+
+	for (vpp = vartab ; vpp < vartab + VTABSIZE ; vpp++)
+		for (vp = *vpp ; vp ; vp = vp->next)
+			n++;
+
+	vs = sp = ckmalloc(n * sizeof(*vs));
+	for (vpp = vartab ; vpp < vartab + VTABSIZE ; vpp++) {
+		for (vp = *vpp ; vp ; vp = vp->next) {
+			sp->vp = vp;
+			sp->flags = vp->flags;
+			sp->text = vp->text;
+			sp->local = vp->local;
+			vp->flags |= VSTRFIXED|VTEXTFIXED|VSNAP;
+			sp++;
+		}
+	}
+	sp->vp = NULL;
+
+	return vs;
+}
+
+
+/*
+ * Undo all changes to variables since savevars, removing the ones made
+ * since then and freeing the record.  Local variables made in the
+ * meantime must already have been popped.
+ * Called with interrupts off.
+ */
+
+void
+restorevars(struct varsave *vs)
+{
+	struct var **vpp, **prev;
+	struct var *vp;
+	struct varsave *sp;
+
+	for (vpp = vartab ; vpp < vartab + VTABSIZE ; vpp++) {
+		for (prev = vpp ; (vp = *prev) ; ) {
+			if (vp->flags & VSNAP) {
+				prev = &vp->next;
+				continue;
+			}
+			*prev = vp->next;
+			if (!(vp->flags & (VTEXTFIXED|VSTACK)))
+				ckfree(vp->text);
+			poolfree(&varpool, vp);
+		}
+	}
+
+	for (sp = vs ; (vp = sp->vp) ; sp++) {
+		vp->local = sp->local;
+		if (vp->text == sp->text) {
+			vp->flags = sp->flags;
+			continue;
+		}
+		if (vp->func && !(sp->flags & VLATEFUNC))
+			(*vp->func)(strchr(sp->text, '\0') + 1);
+		if (!(vp->flags & (VTEXTFIXED|VSTACK)))
+			ckfree(vp->text);
+		vp->flags = sp->flags;
+		vp->text = sp->text;
+		if (vp->func && vp->flags & VLATEFUNC)
+			(*vp->func)(strchr(sp->text, '\0') + 1);
+	}
+
+	ckfree(vs);
+}
+
+
+/*
+ * Add up the variables and the memory their values take for meminfo.
+ * The structures themselves come from varpool and are counted with the
+ * pools.
+ */
+
+void
+varmemuse(struct memuse *mu)
+{
+	struct var **vpp;
+	struct var *vp;
+
+	for (vpp = vartab ; vpp < vartab + VTABSIZE ; vpp++) {
+		for (vp = *vpp ; vp ; vp = vp->next) {
+			mu->count++;
+			if (!(vp->flags & (VTEXTFIXED|VSTACK)))
+				mu->bytes += strlen(vp->text) + 1;
+		}
+	}
+}
+
+
 /*
  * The unset builtin command.  We unset the function before we unset the
  * variable to allow a function to be unset when there is a readonly variable
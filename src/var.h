@@ -59,6 +59,7 @@
 #define VLATEFUNC	0x200	/* call the callback function after the value has been changed */
 #define VUSER1		0x400	/* special flag with per-variable meaning
 				   OPTIND: extra data is stored after the option text */
+#define VSNAP		0x800	/* variable is recorded by savevars */
 
 
 struct var {
@@ -81,6 +82,8 @@ struct localvar {
 };
 
 struct localvar_list;
+struct memuse;
+struct varsave;
 
 
 extern struct localvar *localvars;
@@ -97,6 +100,10 @@ enum {
 	VPS4,
 	VOPTIND,
 	VPWD,
+	VJOBMAX,
+	VPROFILEFILE,
+	VTRACEFD,
+	VTRACEEXPTIME,
 #ifdef WITH_LINENO
 	VLINENO,
 #endif
@@ -124,6 +131,10 @@ enum {
 #define vps4 varinit[VPS4]
 #define voptind varinit[VOPTIND]
 #define vpwd varinit[VPWD]
+#define vjobmax varinit[VJOBMAX]
+#define vprofilefile varinit[VPROFILEFILE]
+#define vtracefd varinit[VTRACEFD]
+#define vtraceexptime varinit[VTRACEEXPTIME]
 #ifdef WITH_LINENO
 #define vlineno varinit[VLINENO]
 #endif
@@ -202,6 +213,10 @@ void mklocal(char *);
 struct localvar_list *pushlocalvars(void);
 void poplocalvars(int);
 void unwindlocalvars(struct localvar_list *stop, int keep);
+void adoptenv(char **);
+struct varsave *savevars(void);
+void restorevars(struct varsave *);
+void varmemuse(struct memuse *);
 int unsetcmd(int, char **);
 void unsetvar(const char *);
 int varcmp(const char *, const char *);